@@ -1,36 +1,61 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "base64.h"
+
 static const char base64_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
 
+/* Maps characters to their 6-bit values. Invalid characters, including the padding, map to 0xFF. */
+static const uint8_t base64_reverse_table[256] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0x3F,
+    0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
 int base64_encode(char *output, size_t output_size, unsigned char *input, size_t length) {
-  int i, j;
-  int padding = 0;
+  size_t i, j;
+  uint32_t block;
 
   size_t encoded_length = (length + 2) / 3 * 4;  // Calculate the encoded length
 
   if (output_size < encoded_length + 1)  // Check if output buffer is large enough
     return -1;
 
-  for (i = 0, j = 0; i < length; i += 3) {
-    unsigned char a = input[i];
-    unsigned char b = (i + 1 < length) ? input[i + 1] : 0;
-    unsigned char c = (i + 2 < length) ? input[i + 2] : 0;
+  /* Full 3-byte blocks */
+  for (i = 0, j = 0; i + 3 <= length; i += 3, j += 4) {
+    block = ((uint32_t)input[i] << 16) | ((uint32_t)input[i + 1] << 8) | input[i + 2];
 
-    output[j++] = base64_table[a >> 2];
-    output[j++] = base64_table[((a & 0x03) << 4) | (b >> 4)];
-    output[j++] = base64_table[((b & 0x0F) << 2) | (c >> 6)];
-    output[j++] = base64_table[c & 0x3F];
+    output[j] = base64_table[block >> 18];
+    output[j + 1] = base64_table[(block >> 12) & 0x3F];
+    output[j + 2] = base64_table[(block >> 6) & 0x3F];
+    output[j + 3] = base64_table[block & 0x3F];
   }
 
-  // Add padding characters if necessary
-  if (length % 3 == 1) {
-    output[j - 2] = '=';
-    output[j - 1] = '=';
-    padding = 2;
-  } else if (length % 3 == 2) {
-    output[j - 1] = '=';
-    padding = 1;
+  // Encode the remaining one or two bytes and add padding characters
+  if (i < length) {
+    block = (uint32_t)input[i] << 16;
+    if (i + 1 < length)
+      block |= (uint32_t)input[i + 1] << 8;
+
+    output[j] = base64_table[block >> 18];
+    output[j + 1] = base64_table[(block >> 12) & 0x3F];
+    output[j + 2] = (i + 1 < length) ? base64_table[(block >> 6) & 0x3F] : '=';
+    output[j + 3] = '=';
+    j += 4;
   }
 
   output[j] = '\0';  // Null-terminate the string
@@ -38,33 +63,49 @@ int base64_encode(char *output, size_t output_size, unsigned char *input, size_t
   return j;
 }
 
-int base64_decode(unsigned char *output, size_t output_size, char *input, size_t length) {
-  int i, j;
-  int padding = 0;
+void base64_stream_init(base64_stream_t *s, uint8_t *dst, size_t dst_size) {
+  s->dst = dst;
+  s->dst_size = dst_size;
+  s->n_written = 0;
+  s->block = 0;
+  s->n_chars = 0;
+  s->n_pad = 0;
+}
 
-  size_t decoded_length = (length * 3) / 4;  // Calculate the maximum decoded length
+int base64_stream_put(base64_stream_t *s, char c) {
+  uint8_t v = base64_reverse_table[(uint8_t)c];
+  size_t n;
+
+  if (c == '=') {
+    /* Padding may only fill the last two characters of the last block */
+    if (s->n_chars < 2)
+      return -1;
+    s->n_pad++;
+    v = 0;
+  } else if ((v & 0x80) || (s->n_pad > 0))
+    return -1;
 
-  if (input[length - 1] == '=') {
-    padding++;
-    if (input[length - 2] == '=')
-      padding++;
-  }
+  s->block = (s->block << 6) | v;
+  if (++s->n_chars < 4)
+    return 0;
 
-  if (output_size < (decoded_length - padding))
+  n = 3 - s->n_pad;
+  if (s->n_written + n > s->dst_size)
     return -1;
 
-  for (i = 0, j = 0; i < length; i += 4) {
-    unsigned char a = strchr(base64_table, input[i]) - base64_table;
-    unsigned char b = strchr(base64_table, input[i + 1]) - base64_table;
-    unsigned char c = strchr(base64_table, input[i + 2]) - base64_table;
-    unsigned char d = strchr(base64_table, input[i + 3]) - base64_table;
-
-    output[j++] = (a << 2) | (b >> 4);
-    if (input[i + 2] != '=')
-      output[j++] = (b << 4) | (c >> 2);
-    if (input[i + 3] != '=')
-      output[j++] = (c << 6) | d;
-  }
+  s->dst[s->n_written++] = s->block >> 16;
+  if (n > 1)
+    s->dst[s->n_written++] = s->block >> 8;
+  if (n > 2)
+    s->dst[s->n_written++] = s->block;
 
-  return j;
+  s->block = 0;
+  s->n_chars = 0;
+  return 0;
+}
+
+int base64_stream_finish(base64_stream_t *s) {
+  if (s->n_chars != 0)
+    return -1;
+  return s->n_written;
 }
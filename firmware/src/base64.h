@@ -1,6 +1,23 @@
 #include <stddef.h>
+#include <stdint.h>
 
 /* URL-safe base64 encode */
 int base64_encode(char *output, size_t output_size, unsigned char *input, size_t length);
-/* URL-safe base64 decode */
-int base64_decode(unsigned char *output, size_t output_size, char *input, size_t length);
\ No newline at end of file
+
+/* State of a decoder for base64 input that arrives character by character */
+typedef struct {
+  uint8_t *dst;
+  size_t dst_size;
+  /* Bytes written to dst */
+  size_t n_written;
+  uint32_t block;
+  /* Characters of the current block and padding characters seen so far */
+  uint8_t n_chars;
+  uint8_t n_pad;
+} base64_stream_t;
+
+void base64_stream_init(base64_stream_t *s, uint8_t *dst, size_t dst_size);
+/* Decodes the next character. Fails on invalid characters, misplaced padding and output that does not fit into dst. */
+int base64_stream_put(base64_stream_t *s, char c);
+/* Ends the input. Returns the number of decoded bytes or -1 if the input was not padded to a multiple of 4. */
+int base64_stream_finish(base64_stream_t *s);
\ No newline at end of file
@@ -0,0 +1,30 @@
+#include "cobs.h"
+
+int cobs_encode(uint8_t *output, size_t output_size, const uint8_t *input, size_t length) {
+  size_t i, j;
+  size_t code_idx = 0;
+  uint8_t code = 1;
+
+  if (output_size < COBS_ENCODED_SIZE(length))
+    return -1;
+
+  for (i = 0, j = 1; i < length; i++) {
+    if (input[i] == 0) {
+      /* Zero bytes are replaced by the distance to the next zero byte */
+      output[code_idx] = code;
+      code_idx = j++;
+      code = 1;
+      continue;
+    }
+    output[j++] = input[i];
+    /* Maximum block length reached, start a new block without implicit zero */
+    if (++code == 0xFF) {
+      output[code_idx] = code;
+      code_idx = j++;
+      code = 1;
+    }
+  }
+  output[code_idx] = code;
+
+  return j;
+}
@@ -0,0 +1,13 @@
+#ifndef __COBS_H_
+#define __COBS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Maximum size of the COBS encoding of length bytes, excluding the frame delimiter */
+#define COBS_ENCODED_SIZE(length) ((length) + (length) / 254 + 1)
+
+/* Consistent overhead byte stuffing. The output never contains a zero byte. */
+int cobs_encode(uint8_t *output, size_t output_size, const uint8_t *input, size_t length);
+
+#endif /* __COBS_H_ */
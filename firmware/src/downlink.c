@@ -0,0 +1,224 @@
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+#include "base64.h"
+#include "downlink.h"
+#include "stats.h"
+
+/* Commands only take up the part of downlink_frame_t up to the end of the command */
+#define COMMAND_SLOT_SIZE \
+  ((offsetof(downlink_frame_t, command) + sizeof(((downlink_frame_t *)0)->command) + 3) & ~(size_t)3)
+
+/* Pools of decoded frames from the host */
+K_MEM_SLAB_DEFINE_STATIC(packet_pool, sizeof(downlink_frame_t), DOWNLINK_PACKET_POOL_SIZE, 4);
+K_MEM_SLAB_DEFINE_STATIC(command_pool, COMMAND_SLOT_SIZE, DOWNLINK_COMMAND_POOL_SIZE, 4);
+
+/* Hands complete frames to the application by pointer. Never fills up, because every frame comes from the pools. */
+K_MSGQ_DEFINE(downlink_mq, sizeof(downlink_frame_t *), DOWNLINK_PACKET_POOL_SIZE + DOWNLINK_COMMAND_POOL_SIZE, 4);
+
+/* Bytes of the stream that no longer take up a frame of the pools */
+static atomic_t consumed;
+
+/* Number of \0-terminated fields of the frame types and how many of them are required */
+static const unsigned int n_fields[] = {[DOWNLINK_PACKET] = 4, [DOWNLINK_COMMAND] = 2};
+static const unsigned int n_fields_required[] = {[DOWNLINK_PACKET] = 3, [DOWNLINK_COMMAND] = 1};
+
+/* State of the framing state machine */
+static struct {
+  /* Frame being decoded or NULL outside of a frame */
+  downlink_frame_t *frame;
+  /* Slots kept from dropped frames for the next frame of the same type */
+  downlink_frame_t *spare[2];
+  /* Index of the \0-terminated field being decoded */
+  unsigned int field;
+  base64_stream_t field_data;
+  /* Bytes of the frame being decoded */
+  uint32_t n_bytes;
+  /* Bytes received in total */
+  uint32_t stream_pos;
+  /* Bytes skipped that are not yet counted as consumed */
+  uint32_t n_skipped;
+} rx;
+
+static struct k_mem_slab *const pools[] = {[DOWNLINK_PACKET] = &packet_pool, [DOWNLINK_COMMAND] = &command_pool};
+
+/* Prepares decoding the field into the frame */
+static void field_start(downlink_frame_t *frame, unsigned int field) {
+  uint8_t *dst = NULL;
+  size_t size = 0;
+
+  if (frame->type == DOWNLINK_PACKET) {
+    switch (field) {
+      case 0:
+        dst = (uint8_t *)&frame->packet.pkt.hdr.dev_id;
+        size = sizeof(frame->packet.pkt.hdr.dev_id);
+        break;
+      case 1:
+        dst = (uint8_t *)&frame->packet.pkt.hdr.pkt_id;
+        size = sizeof(frame->packet.pkt.hdr.pkt_id);
+        break;
+      case 2:
+        dst = frame->packet.pkt.data;
+        size = PKT_PAYLOAD_SIZE;
+        break;
+      case 3:
+        dst = (uint8_t *)&frame->packet.opts;
+        size = sizeof(frame->packet.opts);
+        break;
+    }
+  } else {
+    switch (field) {
+      case 0:
+        dst = &frame->command.cmd;
+        size = sizeof(frame->command.cmd);
+        break;
+      case 1:
+        dst = frame->command.arg;
+        size = DOWNLINK_CMD_ARG_SIZE;
+        break;
+    }
+  }
+  base64_stream_init(&rx.field_data, dst, size);
+}
+
+/* Checks the length of a decoded field */
+static int field_finish(downlink_frame_t *frame, unsigned int field) {
+  int n;
+
+  if ((n = base64_stream_finish(&rx.field_data)) < 0)
+    return -1;
+
+  if (frame->type == DOWNLINK_PACKET) {
+    if (field == 2)
+      frame->packet.pkt.len = sizeof(pkt_header_t) + n;
+    else if ((size_t)n != rx.field_data.dst_size)
+      return -1;
+  } else {
+    if (field == 1)
+      frame->command.arg_len = n;
+    else if ((size_t)n != rx.field_data.dst_size)
+      return -1;
+  }
+  return 0;
+}
+
+/* Drops the frame being decoded and skips data until the next start of a frame */
+static void frame_drop(void) {
+  stats_inc(STATS_DOWNLINK_FRAME_ERRORS);
+  rx.n_skipped += rx.n_bytes;
+  rx.spare[rx.frame->type] = rx.frame;
+  rx.frame = NULL;
+}
+
+static void frame_start(uint8_t type) {
+  /* The previous frame was not terminated */
+  if (rx.frame != NULL)
+    frame_drop();
+
+  if ((rx.frame = rx.spare[type]) != NULL) {
+    rx.spare[type] = NULL;
+  } else if (k_mem_slab_alloc(pools[type], (void **)&rx.frame, K_NO_WAIT) != 0) {
+    /* The frame is skipped like data outside of frames */
+    rx.frame = NULL;
+    rx.n_skipped++;
+    stats_inc(STATS_DOWNLINK_DROPPED);
+    return;
+  }
+
+  rx.frame->type = type;
+  rx.n_bytes = 1;
+  /* Optional fields */
+  if (type == DOWNLINK_PACKET)
+    memset(&rx.frame->packet.opts, 0, sizeof(rx.frame->packet.opts));
+  else
+    rx.frame->command.arg_len = 0;
+
+  rx.field = 0;
+  field_start(rx.frame, 0);
+}
+
+static void frame_end(uint8_t type) {
+  /* Fields must be complete, i.e. the frame ends right after the \0 of the last field */
+  if ((type != rx.frame->type) || (rx.field < n_fields_required[type]) ||
+      ((rx.field < n_fields[type]) && ((rx.field_data.n_written > 0) || (rx.field_data.n_chars > 0)))) {
+    frame_drop();
+    return;
+  }
+
+  rx.frame->n_bytes = rx.n_bytes;
+  rx.frame->stream_pos = rx.stream_pos;
+  /* The data in front of the frame is consumed before the application can take the frame */
+  atomic_add(&consumed, rx.n_skipped);
+  rx.n_skipped = 0;
+  k_msgq_put(&downlink_mq, &rx.frame, K_NO_WAIT);
+  rx.frame = NULL;
+}
+
+void downlink_receive(const uint8_t *data, size_t len) {
+  char c;
+
+  for (size_t i = 0; i < len; i++) {
+    c = data[i];
+    rx.stream_pos++;
+
+    switch (c) {
+      case '[':
+        frame_start(DOWNLINK_PACKET);
+        continue;
+      case '{':
+        frame_start(DOWNLINK_COMMAND);
+        continue;
+      default:
+        break;
+    }
+
+    /* Data outside of frames is skipped */
+    if (rx.frame == NULL) {
+      rx.n_skipped++;
+      continue;
+    }
+
+    rx.n_bytes++;
+    switch (c) {
+      case ']':
+        frame_end(DOWNLINK_PACKET);
+        break;
+      case '}':
+        frame_end(DOWNLINK_COMMAND);
+        break;
+      case '\0':
+        if ((rx.field >= n_fields[rx.frame->type]) || (field_finish(rx.frame, rx.field) < 0)) {
+          frame_drop();
+          break;
+        }
+        if (++rx.field < n_fields[rx.frame->type])
+          field_start(rx.frame, rx.field);
+        break;
+      default:
+        if ((rx.field >= n_fields[rx.frame->type]) || (base64_stream_put(&rx.field_data, c) < 0))
+          frame_drop();
+        break;
+    }
+  }
+
+  /* Skipped data is consumed right away, so that the host gets its credits back without another frame */
+  atomic_add(&consumed, rx.n_skipped);
+  rx.n_skipped = 0;
+}
+
+int downlink_get(downlink_frame_t **frame, k_timeout_t timeout) {
+  int rc;
+
+  if ((rc = k_msgq_get(&downlink_mq, frame, timeout)) == 0)
+    atomic_add(&consumed, (*frame)->n_bytes);
+  return rc;
+}
+
+void downlink_free(downlink_frame_t *frame) {
+  k_mem_slab_free(pools[frame->type], frame);
+}
+
+uint32_t downlink_consumed(void) {
+  return atomic_get(&consumed);
+}
@@ -0,0 +1,69 @@
+#ifndef __DOWNLINK_H_
+#define __DOWNLINK_H_
+
+#include <zephyr/kernel.h>
+
+#include "framing.h"
+#include "packet.h"
+
+/* Maximum size of the argument of a command from the host */
+#define DOWNLINK_CMD_ARG_SIZE 16
+/* Shortest packet frame, i.e. device ID, packet ID and an empty payload, each terminated by \0, in brackets */
+#define DOWNLINK_PACKET_MIN_SIZE (1 + 9 + 5 + 1 + 1)
+/* Shortest command frame, i.e. a command without argument terminated by \0 in curly brackets */
+#define DOWNLINK_COMMAND_MIN_SIZE (1 + 5 + 1)
+/* Longest packet frame, i.e. device ID, packet ID, the largest payload and options, each terminated by \0, in
+ * brackets */
+#define DOWNLINK_FRAME_MAX_SIZE (1 + 9 + 5 + (PKT_PAYLOAD_SIZE + 2) / 3 * 4 + 1 + 5 + 1)
+/* Bytes the host may send before they are consumed. Several of the longest frames keep the link busy while the credits
+ * for the consumed frames are on their way to the host. */
+#define DOWNLINK_WINDOW (4 * DOWNLINK_FRAME_MAX_SIZE)
+/* Number of packets and commands from the host that can be decoded or waiting for the application at the same time.
+ * Even the shortest frames of either type cannot exhaust their pool within the window, taking into account the partial
+ * frame being decoded and the frame being processed by the application. Commands take up much smaller slots. */
+#define DOWNLINK_PACKET_POOL_SIZE (DOWNLINK_WINDOW / DOWNLINK_PACKET_MIN_SIZE + 2)
+#define DOWNLINK_COMMAND_POOL_SIZE (DOWNLINK_WINDOW / DOWNLINK_COMMAND_MIN_SIZE + 2)
+
+enum {
+  /* Enclosed in brackets: device ID, packet ID, payload and optionally downlink_opts_t */
+  DOWNLINK_PACKET = 0,
+  /* Enclosed in curly brackets: command and optionally its argument */
+  DOWNLINK_COMMAND = 1,
+};
+
+/* Frame received from the host, decoded while the data arrives */
+typedef struct {
+  uint8_t type;
+  /* Bytes of the stream taken up by the frame */
+  uint32_t n_bytes;
+  /* Bytes of the stream received up to the end of the frame */
+  uint32_t stream_pos;
+  union {
+    struct {
+      pkt_t pkt;
+      /* Zero if not specified */
+      downlink_opts_t opts;
+    } packet;
+    struct {
+      uint8_t cmd;
+      uint8_t arg_len;
+      uint8_t arg[DOWNLINK_CMD_ARG_SIZE];
+    } command;
+  };
+} downlink_frame_t;
+
+/* Runs the framing state machine over data from the host. Complete frames are handed over to the application, garbled
+ * and oversized frames are dropped until the next start of a frame. Must not be called concurrently. */
+void downlink_receive(const uint8_t *data, size_t len);
+
+/* Get a pointer to the next frame from the host. The frame must be returned with downlink_free(). Its bytes count as
+ * consumed from here on. */
+int downlink_get(downlink_frame_t **frame, k_timeout_t timeout);
+/* Return a frame to its pool */
+void downlink_free(downlink_frame_t *frame);
+
+/* Bytes of the stream that no longer take up a frame of the pools, i.e. frames taken by the application, dropped frames
+ * and data outside of frames. Wraps around like the stream position of the frames. */
+uint32_t downlink_consumed(void);
+
+#endif /* __DOWNLINK_H_ */
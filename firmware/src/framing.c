@@ -0,0 +1,96 @@
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+
+#include "base64.h"
+#include "cobs.h"
+#include "framing.h"
+
+int packet2string(char *dst, size_t dst_size, pkt_t *pkt, int64_t timestamp) {
+  int olen;
+  int n_written = 0;
+
+  dst[n_written++] = '[';
+  if ((olen = base64_encode(dst + n_written, dst_size, (uint8_t *)&pkt->hdr.dev_id, 4)) < 0)
+    return -1;
+
+  /* Make sure to also include the trailing \0 in the string as a delimiter*/
+  n_written += olen + 1;
+  if ((olen = base64_encode(dst + n_written, dst_size - n_written, (uint8_t *)&pkt->hdr.pkt_id, 2)) < 0)
+    return -1;
+
+  n_written += olen + 1;
+  if ((olen = base64_encode(dst + n_written, dst_size - n_written, (uint8_t *)&pkt->hdr.ack_id, 2)) < 0)
+    return -1;
+
+  n_written += olen + 1;
+  if ((olen = base64_encode(dst + n_written, dst_size - n_written, (uint8_t *)&timestamp, 8)) < 0)
+    return -1;
+
+  n_written += olen + 1;
+  if ((olen = base64_encode(dst + n_written, dst_size - n_written, (uint8_t *)&pkt->data,
+                            pkt->len - sizeof(pkt_header_t))) < 0)
+    return -1;
+
+  n_written += olen + 1;
+  dst[n_written++] = ']';
+  return n_written;
+}
+
+int event2string(char *dst, size_t dst_size, uint8_t type, uint8_t *body, size_t len) {
+  int olen;
+  int n_written = 0;
+
+  dst[n_written++] = '{';
+  if ((olen = base64_encode(dst + n_written, dst_size - n_written, &type, 1)) < 0)
+    return -1;
+
+  n_written += olen + 1;
+  if ((olen = base64_encode(dst + n_written, dst_size - n_written, body, len)) < 0)
+    return -1;
+
+  n_written += olen + 1;
+  dst[n_written++] = '}';
+  return n_written;
+}
+
+/* Appends the length and CRC trailer to a raw frame and wraps it into a \0-delimited COBS frame */
+static int frame_encode(uint8_t *dst, size_t dst_size, uint8_t *raw, size_t raw_len) {
+  int olen;
+
+  /* raw must have space for the trailer */
+  sys_put_le16(raw_len, raw + raw_len);
+  sys_put_le16(crc16_itu_t(0xFFFF, raw, raw_len + 2), raw + raw_len + 2);
+
+  if ((olen = cobs_encode(dst, dst_size - 1, raw, raw_len + FRAME_TRAILER_SIZE)) < 0)
+    return -1;
+
+  dst[olen++] = '\0';
+  return olen;
+}
+
+int packet2frame(uint8_t *dst, size_t dst_size, pkt_t *pkt, int64_t timestamp) {
+  uint8_t raw[1 + sizeof(int64_t) + sizeof(pkt_t) + FRAME_TRAILER_SIZE];
+  size_t n = 0;
+
+  raw[n++] = FRAME_TYPE_PACKET;
+  sys_put_le64(timestamp, raw + n);
+  n += sizeof(int64_t);
+
+  /* The packet is passed as is, including the length field */
+  memcpy(raw + n, pkt, pkt->len + 1);
+  n += pkt->len + 1;
+
+  return frame_encode(dst, dst_size, raw, n);
+}
+
+int event2frame(uint8_t *dst, size_t dst_size, uint8_t type, uint8_t *body, size_t len) {
+  uint8_t raw[1 + EVENT_BODY_MAX_SIZE + FRAME_TRAILER_SIZE];
+
+  if (len > EVENT_BODY_MAX_SIZE)
+    return -1;
+
+  raw[0] = type;
+  memcpy(raw + 1, body, len);
+  return frame_encode(dst, dst_size, raw, len + 1);
+}
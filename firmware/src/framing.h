@@ -0,0 +1,111 @@
+#ifndef __FRAMING_H_
+#define __FRAMING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "packet.h"
+#include "stats.h"
+
+/* Worst case size of an encoded packet in any framing */
+#define PKT_FRAME_MAX_SIZE 384
+/* Size of the length and CRC trailer of binary frames */
+#define FRAME_TRAILER_SIZE 4
+/* Maximum size of the body of events sent to the host */
+#define EVENT_BODY_MAX_SIZE 64
+
+/* Framing of the data sent to the host */
+enum {
+  /* Base64 encoded fields separated by \0 and enclosed in brackets */
+  FRAMING_TEXT = 0,
+  /* COBS encoded raw structures with length and CRC trailer, delimited by \0 */
+  FRAMING_BINARY = 1,
+};
+
+/* Types of frames sent to the host */
+enum {
+  FRAME_TYPE_PACKET = 0x01,
+  /* Confirms a change of framing */
+  FRAME_TYPE_FRAMING = 0x02,
+  /* A packet from the host could not be queued */
+  FRAME_TYPE_REJECTED = 0x03,
+  /* Periodic report of the pipeline counters */
+  FRAME_TYPE_STATS = 0x04,
+  /* Result of a radio configuration command (int8_t) followed by the active radio_cfg_t */
+  FRAME_TYPE_RADIO = 0x05,
+  /* Answer to a time synchronization request */
+  FRAME_TYPE_TIME = 0x06,
+  /* A packet from the host was sent to its device as acknowledgement */
+  FRAME_TYPE_DELIVERED = 0x07,
+  /* A packet from the host was discarded before it could be delivered */
+  FRAME_TYPE_DISCARDED = 0x08,
+  /* Flow control for data from the host */
+  FRAME_TYPE_CREDIT = 0x09,
+};
+
+typedef struct __attribute__((packed)) {
+  uint32_t dev_id;
+  uint16_t pkt_id;
+  /* Negative error code returned by the message buffer */
+  int8_t err;
+} evt_rejected_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t dev_id;
+  uint16_t pkt_id;
+} evt_delivered_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t dev_id;
+  uint16_t pkt_id;
+  /* MSG_DISCARD_* */
+  uint8_t reason;
+} evt_discarded_t;
+
+/* The host may send as many bytes as fit into the window beyond the bytes consumed so far */
+typedef struct __attribute__((packed)) {
+  /* Bytes received from the host since the last CMD_SET_FRAMING, including dropped ones */
+  uint32_t consumed;
+  uint16_t window;
+} evt_credit_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t uptime_ms;
+  uint32_t counters[STATS_NUM];
+} evt_stats_t;
+
+typedef struct __attribute__((packed)) {
+  /* Copied from the request to match the answer */
+  uint32_t token;
+  /* Microseconds since boot on the same clock as the packet timestamps */
+  uint64_t time_us;
+} evt_time_t;
+
+/* Commands received from the host */
+enum {
+  CMD_SET_FRAMING = 0x01,
+  /* Argument is a radio_cfg_t */
+  CMD_SET_RADIO = 0x02,
+  /* Argument is a uint32_t token that is returned with the current time */
+  CMD_TIME_SYNC = 0x03,
+};
+
+/* Options that may follow the payload of a packet from the host */
+typedef struct __attribute__((packed)) {
+  /* Time to live in seconds or 0 for the default */
+  uint16_t ttl_s;
+  /* MSG_FLAG_* */
+  uint8_t flags;
+} downlink_opts_t;
+
+/* Text framing of a packet with the specified timestamp in microseconds. Returns the number of bytes written. */
+int packet2string(char *dst, size_t dst_size, pkt_t *pkt, int64_t timestamp);
+/* Text framing of an event */
+int event2string(char *dst, size_t dst_size, uint8_t type, uint8_t *body, size_t len);
+
+/* Binary framing of a packet with the specified timestamp in microseconds. Returns the number of bytes written. */
+int packet2frame(uint8_t *dst, size_t dst_size, pkt_t *pkt, int64_t timestamp);
+/* Binary framing of an event */
+int event2frame(uint8_t *dst, size_t dst_size, uint8_t type, uint8_t *body, size_t len);
+
+#endif /* __FRAMING_H_ */
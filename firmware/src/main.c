@@ -10,13 +10,30 @@
 #include <zephyr/usb/usb_device.h>
 #include <zephyr/usb/usbd.h>
 
-#include "base64.h"
+#include "downlink.h"
+#include "framing.h"
 #include "radio.h"
 #include "message_buffer.h"
+#include "timestamp.h"
+#include "stats.h"
 
 #define RING_BUF_SIZE 2048
 #define PRINTER_STACK_SIZE 2048
 #define CDCACM_STACK_SIZE 2048
+#define DELIVERY_STACK_SIZE 1024
+
+/* Interval between two statistics reports to the host */
+#define STATS_INTERVAL_MS 1000
+/* Interval between two sweeps for expired packets in the message buffer */
+#define MSG_SWEEP_INTERVAL_MS 1000
+/* Time to wait for space in the CDC ACM TX ringbuffer before a frame is dropped */
+#define TX_BACKPRESSURE_TIMEOUT_MS 100
+/* Packets are batched until they fill a full-speed bulk transfer ... */
+#define TX_BATCH_SIZE 64
+/* ... or until the first packet of the batch has waited this long. 0 only batches packets that are already queued. */
+#define TX_BATCH_LATENCY_MS 2
+/* Upper bound for a batch under sustained load */
+#define TX_BATCH_MAX_SIZE (RING_BUF_SIZE / 2)
 
 LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
 
@@ -24,9 +41,25 @@ LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
 #define LED0_NODE DT_ALIAS(led0)
 
 RING_BUF_DECLARE(cdcacm_ringbuf_tx, RING_BUF_SIZE);
-RING_BUF_DECLARE(cdcacm_ringbuf_rx, RING_BUF_SIZE);
 
-K_EVENT_DEFINE(uart_rx_evt);
+/* Serializes access to the CDC ACM TX ringbuffer and the framing */
+K_MUTEX_DEFINE(tx_lock);
+/* Signals that the CDC ACM TX ringbuffer has been drained */
+K_SEM_DEFINE(tx_space_sem, 0, 1);
+
+/* Consumed bytes of the downlink at the start of the host session, i.e. at the end of the last CMD_SET_FRAMING. Credits
+ * are only reported by the cdcacm thread, so that reports cannot overtake each other. */
+static uint32_t rx_consumed_base;
+/* Consumed bytes of the downlink at the last credit report */
+static uint32_t rx_consumed_reported;
+/* Interval of credit reports while no frames arrive. Hands out the credits for skipped data and recovers the flow
+ * control if a report was dropped. */
+#define CREDIT_REFRESH_MS 1000
+/* Bytes consumed before the host is given new credits without waiting for the periodic report */
+#define CREDIT_REPORT_THRESHOLD (DOWNLINK_WINDOW / 4)
+
+/* Text framing is the default until the host asks for something else */
+static uint8_t framing = FRAMING_TEXT;
 
 static void interrupt_handler(const struct device *dev, void *user_data) {
   ARG_UNUSED(user_data);
@@ -36,198 +69,312 @@ static void interrupt_handler(const struct device *dev, void *user_data) {
       int recv_len;
       uint8_t buffer[64];
 
-      /* Claim some space on the ringbuffer */
       recv_len = uart_fifo_read(dev, buffer, sizeof(buffer));
       if (recv_len < 0) {
         LOG_ERR("Failed to read UART FIFO");
         continue;
       }
-      uint32_t written = ring_buf_put(&cdcacm_ringbuf_rx, buffer, recv_len);
-      if (written > 0)
-        k_event_set(&uart_rx_evt, 0xFFFFFFFF);
-      else
-        LOG_ERR("UART ringbuffer full");
+      /* Decodes the data straight into the downlink frames. The application is only woken up for complete frames. */
+      downlink_receive(buffer, recv_len);
     }
 
     if (uart_irq_tx_ready(dev)) {
-      uint8_t buffer[64];
+      uint8_t *data;
       int rb_len, send_len;
 
-      rb_len = ring_buf_get(&cdcacm_ringbuf_tx, buffer, sizeof(buffer));
+      rb_len = ring_buf_get_claim(&cdcacm_ringbuf_tx, &data, 64);
       if (!rb_len) {
         LOG_DBG("Ring buffer empty, disable TX IRQ");
         uart_irq_tx_disable(dev);
         continue;
       }
 
-      send_len = uart_fifo_fill(dev, buffer, rb_len);
-      if (send_len < rb_len) {
-        LOG_ERR("Drop %d bytes", rb_len - send_len);
-      }
+      send_len = uart_fifo_fill(dev, data, rb_len);
+      if (send_len < 0)
+        send_len = 0;
+      /* Bytes that did not fit into the FIFO stay in the ringbuffer for the next round */
+      ring_buf_get_finish(&cdcacm_ringbuf_tx, send_len);
+      k_sem_give(&tx_space_sem);
 
       LOG_DBG("ringbuf -> tty fifo %d bytes", send_len);
     }
   }
 }
 
-static int string2packet(pkt_t *dst, char *pkt_str, size_t pkt_str_len) {
-  int n_written;
-  size_t n;
-  char *s = pkt_str;
+int cdcacm_init(void) {
+  const struct device *dev;
+  uint32_t dtr;
 
-  if ((n = strlen(s)) != 8)
+  dev = DEVICE_DT_GET_ONE(zephyr_cdc_acm_uart);
+  if (!device_is_ready(dev)) {
+    LOG_ERR("CDC ACM device not ready");
     return -1;
+  }
 
-  if (base64_decode((uint8_t *)&dst->hdr.dev_id, 4, s, n) < 0)
-    return -1;
+  LOG_INF("Wait for DTR");
 
-  s += n + 1;
-  if ((n = strlen(s)) != 4)
-    return -1;
+  while (true) {
+    uart_line_ctrl_get(dev, UART_LINE_CTRL_DTR, &dtr);
+    if (dtr) {
+      break;
+    } else {
+      k_msleep(10);
+    }
+  }
 
-  if (base64_decode((uint8_t *)&dst->hdr.pkt_id, 2, s, n) < 0)
-    return -1;
+  LOG_INF("DTR set");
 
-  s += n + 1;
-  if ((s - pkt_str) > pkt_str_len)
-    return -1;
-  n = strlen(s);
+  uart_irq_callback_set(dev, interrupt_handler);
 
-  if ((n_written = base64_decode((uint8_t *)&dst->data, PKT_PAYLOAD_SIZE, s, n)) < 0)
-    return -1;
+  /* Enable rx interrupts */
+  uart_irq_rx_enable(dev);
 
-  dst->len = sizeof(pkt_header_t) + n_written;
+  if (!ring_buf_is_empty(&cdcacm_ringbuf_tx))
+    uart_irq_tx_enable(dev);
   return 0;
 }
 
-static int packet2string(char *dst, size_t dst_size, pkt_t *pkt) {
-  int olen;
-  int n_written = 0;
+/* Waits for a bounded time until the TX ringbuffer has space for len bytes. Must be called with tx_lock held. */
+static int cdcacm_wait_space(const struct device *dev, size_t len) {
+  int64_t deadline = k_uptime_get() + TX_BACKPRESSURE_TIMEOUT_MS;
+  int64_t remaining;
 
-  int64_t timestamp = k_uptime_get();
+  while (ring_buf_space_get(&cdcacm_ringbuf_tx) < len) {
+    /* Make sure that the ringbuffer is being drained */
+    uart_irq_tx_enable(dev);
 
-  dst[n_written++] = '[';
-  if ((olen = base64_encode(dst + n_written, dst_size, (uint8_t *)&pkt->hdr.dev_id, 4)) < 0)
-    return -1;
+    remaining = deadline - k_uptime_get();
+    if ((remaining <= 0) || (k_sem_take(&tx_space_sem, K_MSEC(remaining)) != 0)) {
+      stats_inc(STATS_TX_RING_DROPPED);
+      return -1;
+    }
+  }
+  return 0;
+}
 
-  /* Make sure to also include the trailing \0 in the string as a delimiter*/
-  n_written += olen + 1;
-  if ((olen = base64_encode(dst + n_written, dst_size - n_written, (uint8_t *)&pkt->hdr.pkt_id, 2)) < 0)
+/* Hands data over to the CDC ACM. Waits for a bounded time if the ringbuffer is full. Must be called with tx_lock
+ * held. */
+static int cdcacm_write(const struct device *dev, uint8_t *data, size_t len) {
+  if (cdcacm_wait_space(dev, len) < 0)
     return -1;
 
-  n_written += olen + 1;
-  if ((olen = base64_encode(dst + n_written, dst_size - n_written, (uint8_t *)&pkt->hdr.ack_id, 2)) < 0)
-    return -1;
+  ring_buf_put(&cdcacm_ringbuf_tx, data, len);
+  uart_irq_tx_enable(dev);
+  return 0;
+}
 
-  n_written += olen + 1;
-  if ((olen = base64_encode(dst + n_written, dst_size - n_written, (uint8_t *)&timestamp, 8)) < 0)
-    return -1;
+/* Encodes a packet according to the framing directly into the TX ringbuffer. The data is not handed over to the CDC
+ * ACM until the TX IRQ is enabled. Must be called with tx_lock held. */
+static int cdcacm_put_packet(const struct device *dev, rx_pkt_t *rx) {
+  static uint8_t pkt_descriptor[PKT_FRAME_MAX_SIZE];
+  uint8_t *dst;
+  bool wrapped = false;
+  int n;
 
-  n_written += olen + 1;
-  if ((olen = base64_encode(dst + n_written, dst_size - n_written, (uint8_t *)&pkt->data,
-                            pkt->len - sizeof(pkt_header_t))) < 0)
+  if (cdcacm_wait_space(dev, PKT_FRAME_MAX_SIZE) < 0) {
+    LOG_DBG("Ringbuf full. Dropping packet descriptor.");
     return -1;
+  }
+
+  if (ring_buf_put_claim(&cdcacm_ringbuf_tx, &dst, PKT_FRAME_MAX_SIZE) < PKT_FRAME_MAX_SIZE) {
+    /* Free space wraps around the end of the ringbuffer. Encode into a separate buffer and copy. */
+    ring_buf_put_finish(&cdcacm_ringbuf_tx, 0);
+    dst = pkt_descriptor;
+    wrapped = true;
+  }
+
+  if (framing == FRAMING_BINARY)
+    n = packet2frame(dst, PKT_FRAME_MAX_SIZE, &rx->pkt, rx->timestamp);
+  else
+    n = packet2string((char *)dst, PKT_FRAME_MAX_SIZE, &rx->pkt, rx->timestamp);
 
-  n_written += olen + 1;
-  dst[n_written++] = ']';
-  return n_written;
+  if (n < 0)
+    LOG_ERR("Error encoding packet");
+
+  if (wrapped) {
+    if (n > 0)
+      ring_buf_put(&cdcacm_ringbuf_tx, dst, n);
+  } else
+    ring_buf_put_finish(&cdcacm_ringbuf_tx, (n > 0) ? n : 0);
+
+  return n;
 }
 
-/* Reads data from the CDC ACM RX ringbuffer into dst until the specified character is found. */
-static int ring_buf_read_until(char *dst, size_t size_dst, char c) {
-  char *buf_slice_p;
-  int n_to_copy;
-  char *rc_find;
-  char *p = dst;
-  int rb_size;
-
-  do {
-    /* Wait for a slice from the CDC ACM RX ringbuffer, blocking on the associated event */
-    while ((rb_size = ring_buf_get_claim(&cdcacm_ringbuf_rx, (uint8_t **)&buf_slice_p, 64)) == 0)
-      k_event_wait(&uart_rx_evt, 0xFFFFFFFF, true, K_FOREVER);
-
-    if ((rc_find = memchr(buf_slice_p, c, rb_size)) == NULL)
-      n_to_copy = rb_size;
-    else
-      n_to_copy = rc_find - buf_slice_p + 1;
-
-    /* Check if the buffer would overflow */
-    if ((p + n_to_copy) >= (dst + size_dst))
-      return -1;
-    memcpy(p, buf_slice_p, n_to_copy);
-    /* Tell the ringbuffer how many bytes we've consumed */
-    ring_buf_get_finish(&cdcacm_ringbuf_rx, n_to_copy);
-    p += n_to_copy;
-  } while (rc_find == NULL);
-  return p - dst;
+/* Sends an event to the host using the current framing */
+static int send_event(const struct device *dev, uint8_t type, void *body, size_t len) {
+  static uint8_t evt_buf[2 * EVENT_BODY_MAX_SIZE + 16];
+  int n, rc;
+
+  k_mutex_lock(&tx_lock, K_FOREVER);
+  if (framing == FRAMING_BINARY)
+    n = event2frame(evt_buf, sizeof(evt_buf), type, body, len);
+  else
+    n = event2string((char *)evt_buf, sizeof(evt_buf), type, body, len);
+
+  rc = (n < 0) ? n : cdcacm_write(dev, evt_buf, n);
+  k_mutex_unlock(&tx_lock);
+
+  return rc;
 }
 
-int cdcacm_init(void) {
-  const struct device *dev;
-  uint32_t dtr;
+/* Tells the host how many bytes it may send */
+static void send_credit(const struct device *dev) {
+  evt_credit_t evt;
 
-  dev = DEVICE_DT_GET_ONE(zephyr_cdc_acm_uart);
-  if (!device_is_ready(dev)) {
-    LOG_ERR("CDC ACM device not ready");
-    return -1;
-  }
+  rx_consumed_reported = downlink_consumed();
+  evt.consumed = rx_consumed_reported - rx_consumed_base;
+  evt.window = DOWNLINK_WINDOW;
+  send_event(dev, FRAME_TYPE_CREDIT, &evt, sizeof(evt));
+}
 
-  LOG_INF("Wait for DTR");
+/* Switches the framing of data sent to the host. The confirmation is always sent as text frame. */
+static void set_framing(const struct device *dev, uint8_t mode) {
+  char buf[32];
+  int n;
 
-  while (true) {
-    uart_line_ctrl_get(dev, UART_LINE_CTRL_DTR, &dtr);
-    if (dtr) {
-      break;
-    } else {
-      k_msleep(10);
-    }
+  if ((mode != FRAMING_TEXT) && (mode != FRAMING_BINARY)) {
+    LOG_ERR("Unknown framing %u", mode);
+    return;
   }
 
-  LOG_INF("DTR set");
+  k_mutex_lock(&tx_lock, K_FOREVER);
+  /* Terminates a partially received binary frame on the host side */
+  buf[0] = '\0';
+  if ((n = event2string(buf + 1, sizeof(buf) - 1, FRAME_TYPE_FRAMING, &mode, 1)) < 0)
+    LOG_ERR("Error encoding event");
+  else if (cdcacm_write(dev, (uint8_t *)buf, n + 1) < 0)
+    LOG_ERR("Ringbuf full. Keeping framing.");
+  else
+    framing = mode;
+  k_mutex_unlock(&tx_lock);
+
+  LOG_INF("Framing: %u", framing);
+}
 
-  uart_irq_callback_set(dev, interrupt_handler);
+static void set_radio(const struct device *dev, uint8_t *arg) {
+  radio_cfg_t cfg;
+  uint8_t body[1 + sizeof(radio_cfg_t)];
+  int rc;
 
-  /* Enable rx interrupts */
-  uart_irq_rx_enable(dev);
+  memcpy(&cfg, arg, sizeof(cfg));
+  if ((rc = radio_configure(&cfg)) < 0)
+    LOG_ERR("Invalid radio configuration: %d", rc);
+  else
+    LOG_INF("Radio: rate %u, %u channels, dwell %u ms", cfg.rate, cfg.n_channels, cfg.dwell_ms);
 
-  if (!ring_buf_is_empty(&cdcacm_ringbuf_tx))
-    uart_irq_tx_enable(dev);
-  return 0;
+  /* Report the result together with the configuration that is now active */
+  body[0] = (uint8_t)rc;
+  radio_get_config((radio_cfg_t *)&body[1]);
+  send_event(dev, FRAME_TYPE_RADIO, body, sizeof(body));
 }
 
-/* Receives incoming data stream from cdc acm, extracts packets and processes the result */
-void cdcacm_handler(void) {
-  static char pkt_string_buf[512];
+/* Answers a time synchronization request of the host with the current time */
+static void send_time(const struct device *dev, uint8_t *arg) {
+  evt_time_t evt;
+
+  memcpy(&evt.token, arg, sizeof(evt.token));
+  evt.time_us = timestamp_get();
+  send_event(dev, FRAME_TYPE_TIME, &evt, sizeof(evt));
+}
+
+static void process_command(const struct device *dev, downlink_frame_t *frame) {
+  uint8_t cmd = frame->command.cmd, *arg = frame->command.arg;
+  size_t arg_len = frame->command.arg_len;
+
+  switch (cmd) {
+    case CMD_SET_FRAMING:
+      if (arg_len != 1)
+        break;
+      set_framing(dev, arg[0]);
+      /* A new host session starts counting its credits after this command */
+      rx_consumed_base = frame->stream_pos;
+      send_credit(dev);
+      return;
+    case CMD_SET_RADIO:
+      if (arg_len != sizeof(radio_cfg_t))
+        break;
+      set_radio(dev, arg);
+      return;
+    case CMD_TIME_SYNC:
+      if (arg_len != sizeof(uint32_t))
+        break;
+      send_time(dev, arg);
+      return;
+    default:
+      break;
+  }
+  LOG_ERR("Invalid command %u (%u)", cmd, arg_len);
+}
+
+/* Tells the host that a queued packet was discarded */
+static void report_discarded(uint32_t dev_id, uint16_t pkt_id, uint8_t reason) {
+  evt_discarded_t evt = {.dev_id = dev_id, .pkt_id = pkt_id, .reason = reason};
+
+  LOG_DBG("Discarded packet %04X for %08X: %u", pkt_id, dev_id, reason);
+  send_event(DEVICE_DT_GET_ONE(zephyr_cdc_acm_uart), FRAME_TYPE_DISCARDED, &evt, sizeof(evt));
+}
 
-  pkt_t pkt;
+/* Processes the packets and commands from the host */
+void cdcacm_handler(void) {
+  const struct device *dev;
+  downlink_frame_t *frame;
+  pkt_t *pkt;
   int rc;
-  int pkt_str_len;
+
+  dev = DEVICE_DT_GET_ONE(zephyr_cdc_acm_uart);
+  if (!device_is_ready(dev)) {
+    LOG_ERR("CDC ACM device not ready");
+    return;
+  }
+
   while (1) {
-    /* Search for start of packet */
-    if ((pkt_str_len = ring_buf_read_until(pkt_string_buf, sizeof(pkt_string_buf), '[')) < 0)
-      continue;
+    /* Hand out new credits before the host runs out */
+    if (downlink_consumed() - rx_consumed_reported >= CREDIT_REPORT_THRESHOLD)
+      send_credit(dev);
 
-    /* Search for end of packet */
-    if ((pkt_str_len = ring_buf_read_until(pkt_string_buf, sizeof(pkt_string_buf), ']')) < 0)
+    if (downlink_get(&frame, K_MSEC(CREDIT_REFRESH_MS)) != 0) {
+      send_credit(dev);
       continue;
+    }
 
-    /* pkt_string_buf contains packet string plus closing bracket */
-    if ((rc = string2packet(&pkt, pkt_string_buf, pkt_str_len - 1)) < 0) {
-      LOG_ERR("Error processing packet: %d", rc);
+    if (frame->type == DOWNLINK_COMMAND) {
+      process_command(dev, frame);
+      downlink_free(frame);
       continue;
     }
-    LOG_DBG("Packet processed: %08X, %04X", pkt.hdr.dev_id, pkt.hdr.pkt_id);
-    msg_buf_insert(&pkt);
+
+    pkt = &frame->packet.pkt;
+    LOG_DBG("Packet processed: %08X, %04X", pkt->hdr.dev_id, pkt->hdr.pkt_id);
+    if ((rc = msg_buf_insert(pkt, frame->packet.opts.ttl_s, frame->packet.opts.flags, report_discarded)) < 0) {
+      stats_inc(STATS_DOWNLINK_REJECTED);
+      LOG_WRN("Rejected packet %04X for %08X: %d", pkt->hdr.pkt_id, pkt->hdr.dev_id, rc);
+      evt_rejected_t evt = {.dev_id = pkt->hdr.dev_id, .pkt_id = pkt->hdr.pkt_id, .err = rc};
+      send_event(dev, FRAME_TYPE_REJECTED, &evt, sizeof(evt));
+    }
+    downlink_free(frame);
   }
 }
 
-/* Receives packets from the radio packet queue, generates a base64 based string and hands it over to the CDC ACM*/
+static void send_stats(const struct device *dev) {
+  evt_stats_t evt;
+
+  evt.uptime_ms = k_uptime_get_32();
+  for (unsigned int i = 0; i < STATS_NUM; i++)
+    evt.counters[i] = atomic_get(&stats[i]);
+
+  send_event(dev, FRAME_TYPE_STATS, &evt, sizeof(evt));
+}
+
+/* Receives packets from the radio packet queue, encodes them according to the framing and hands them over to the CDC
+ * ACM*/
 void printer_handler() {
   const struct device *dev;
-  static char pkt_descriptor[512];
 
-  pkt_t pkt_buf;
+  rx_pkt_t *rx;
   int n;
+  size_t batch_len;
+  int64_t batch_deadline;
+  int64_t stats_deadline;
 
   dev = DEVICE_DT_GET_ONE(zephyr_cdc_acm_uart);
   if (!device_is_ready(dev)) {
@@ -235,27 +382,72 @@ void printer_handler() {
     return;
   }
 
+  stats_deadline = k_uptime_get() + STATS_INTERVAL_MS;
   while (1) {
-    /* Grab a packet from the queue */
-    radio_msgq_get(&pkt_buf, K_FOREVER);
-
-    if ((pkt_buf.len > (sizeof(pkt_t) - 1) || (pkt_buf.len < 8))) {
-      LOG_ERR("Received packet with wrong size");
-      continue;
+    if (k_uptime_get() >= stats_deadline) {
+      send_stats(dev);
+      stats_deadline += STATS_INTERVAL_MS;
     }
 
-    if ((n = packet2string(pkt_descriptor, sizeof(pkt_descriptor), &pkt_buf)) < 0) {
-      LOG_ERR("Error encoding packet");
+    /* Grab a packet from the queue, waking up in time for the next statistics report */
+    if (radio_msgq_get(&rx, K_TIMEOUT_ABS_MS(stats_deadline)) != 0)
       continue;
-    }
 
-    if (ring_buf_space_get(&cdcacm_ringbuf_tx) >= n) {
-      ring_buf_put(&cdcacm_ringbuf_tx, pkt_descriptor, n);
+    batch_len = 0;
+    batch_deadline = k_uptime_get() + TX_BATCH_LATENCY_MS;
+    do {
+      if ((rx->pkt.len > (sizeof(pkt_t) - 1) || (rx->pkt.len < 8))) {
+        LOG_ERR("Received packet with wrong size");
+        radio_pkt_free(rx);
+        continue;
+      }
+
+      k_mutex_lock(&tx_lock, K_FOREVER);
+      n = cdcacm_put_packet(dev, rx);
+      k_mutex_unlock(&tx_lock);
+
+      if (n > 0)
+        batch_len += n;
+
+      LOG_INF("[%08X:%04X:%04X(%u)]", rx->pkt.hdr.dev_id, rx->pkt.hdr.pkt_id, rx->pkt.hdr.ack_id, rx->pkt.len);
+      radio_pkt_free(rx);
+      /* Wait for more packets until the batch fills a transfer or the deadline passes, then only take what is
+       * already queued */
+    } while ((batch_len < TX_BATCH_MAX_SIZE) &&
+             (radio_msgq_get(&rx, (batch_len < TX_BATCH_SIZE) ? K_TIMEOUT_ABS_MS(batch_deadline) : K_NO_WAIT) == 0));
+
+    /* Hand the whole batch over to the CDC ACM at once */
+    if (batch_len > 0)
       uart_irq_tx_enable(dev);
-    } else
-      LOG_DBG("Ringbuf full. Dropping packet descriptor.");
+  }
+}
+
+/* Reports downlink packets that were sent to their device to the host and discards packets that expired */
+void delivery_handler() {
+  const struct device *dev;
+  radio_delivered_t delivered;
+  evt_delivered_t evt;
+  int64_t sweep_deadline;
+
+  dev = DEVICE_DT_GET_ONE(zephyr_cdc_acm_uart);
+  if (!device_is_ready(dev)) {
+    LOG_ERR("CDC ACM device not ready");
+    return;
+  }
 
-    LOG_INF("[%08X:%04X:%04X(%u)]", pkt_buf.hdr.dev_id, pkt_buf.hdr.pkt_id, pkt_buf.hdr.ack_id, pkt_buf.len);
+  sweep_deadline = k_uptime_get() + MSG_SWEEP_INTERVAL_MS;
+  while (1) {
+    if (k_uptime_get() >= sweep_deadline) {
+      msg_buf_sweep(report_discarded);
+      sweep_deadline += MSG_SWEEP_INTERVAL_MS;
+    }
+
+    if (radio_delivered_get(&delivered, K_TIMEOUT_ABS_MS(sweep_deadline)) != 0)
+      continue;
+    evt.dev_id = delivered.dev_id;
+    evt.pkt_id = delivered.pkt_id;
+    LOG_DBG("Delivered packet %04X to %08X", evt.pkt_id, evt.dev_id);
+    send_event(dev, FRAME_TYPE_DELIVERED, &evt, sizeof(evt));
   }
 }
 
@@ -282,6 +474,7 @@ int main(void) {
   cdcacm_init();
 
   msg_buf_init();
+  timestamp_init();
   radio_init();
   radio_start();
 
@@ -290,4 +483,5 @@ int main(void) {
 
 K_THREAD_DEFINE(printer, PRINTER_STACK_SIZE, printer_handler, NULL, NULL, NULL, 2, 0, 0);
 K_THREAD_DEFINE(cdcacm, CDCACM_STACK_SIZE, cdcacm_handler, NULL, NULL, NULL, 2, 0, 0);
+K_THREAD_DEFINE(delivery, DELIVERY_STACK_SIZE, delivery_handler, NULL, NULL, NULL, 2, 0, 0);
 K_THREAD_DEFINE(blinky, CDCACM_STACK_SIZE, blinky_thread, NULL, NULL, NULL, 3, 0, 0);
\ No newline at end of file
@@ -1,98 +1,272 @@
-#include <zephyr/sys/ring_buffer.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/slist.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/device.h>
+#include <string.h>
 
 #include "message_buffer.h"
+#include "message_buffer_priv.h"
 #include "radio.h"
 
 LOG_MODULE_REGISTER(message_buffer, LOG_LEVEL_INF);
 
-#define MAX_NUM_DEVICES 16
-#define PKTS_PER_BUF 16
+BUILD_ASSERT(DEV_INDEX_SIZE >= 4 * MAX_NUM_DEVICES, "Device index too small");
+
+/* A pending packet allocated from the pool */
+typedef struct {
+  sys_snode_t node;
+  /* Uptime in milliseconds after which the packet is discarded */
+  int64_t expires;
+  uint8_t flags;
+  /* Only the header and the actual payload of the packet are allocated */
+  pkt_t pkt;
+} queued_pkt_t;
 
 typedef struct {
   bool in_use;
   /* ID of recipient for this message queue. */
   uint32_t dev_id;
-  struct ring_buf msg_buf;
-  uint8_t msg_buf_data[PKTS_PER_BUF * sizeof(pkt_t)];
+  /* FIFO of queued_pkt_t */
+  sys_slist_t pkts;
+  unsigned int n_pkts;
+  /* The first packet is being sent by the radio and must stay in place */
+  bool claimed;
 } dev_msg_buf_t;
 
+K_HEAP_DEFINE(msg_pool, MSG_POOL_SIZE);
+
 dev_msg_buf_t buffers[MAX_NUM_DEVICES];
 
-/* Get pointer to the dev_msg_buf for the specified device ID */
+/* Open addressing hash table with linear probing that maps device IDs to buffers in use */
+static dev_msg_buf_t *dev_index[DEV_INDEX_SIZE];
+
+/* Stack of buffers that are not in use */
+static dev_msg_buf_t *free_bufs[MAX_NUM_DEVICES];
+static unsigned int n_free_bufs;
+
+/* Protects the device index, the free buffers and the FIFOs against the radio ISR */
+static struct k_spinlock index_lock;
+
+/* Get pointer to the dev_msg_buf for the specified device ID. Runs in constant time on average. */
 static inline dev_msg_buf_t *get_dev_msg_buf(uint32_t dev_id) {
-  for (unsigned int buf_idx = 0; buf_idx < MAX_NUM_DEVICES; buf_idx++) {
-    if (buffers[buf_idx].in_use && (dev_id == buffers[buf_idx].dev_id))
-      return &buffers[buf_idx];
+  for (unsigned int i = dev_index_hash(dev_id); dev_index[i] != NULL; i = (i + 1) & (DEV_INDEX_SIZE - 1)) {
+    if (dev_index[i]->dev_id == dev_id)
+      return dev_index[i];
   }
   return NULL;
 }
 
-static inline dev_msg_buf_t *get_empty_msg_buf() {
-  for (unsigned int buf_idx = 0; buf_idx < MAX_NUM_DEVICES; buf_idx++) {
-    if (!buffers[buf_idx].in_use)
-      return &buffers[buf_idx];
+/* Claims an empty buffer for the device ID and adds it to the index. Must be called with index_lock held. */
+static dev_msg_buf_t *add_dev_msg_buf(uint32_t dev_id) {
+  dev_msg_buf_t *dev_msg_buf;
+  unsigned int i;
+
+  if (n_free_bufs == 0)
+    return NULL;
+
+  dev_msg_buf = free_bufs[--n_free_bufs];
+  dev_msg_buf->dev_id = dev_id;
+  dev_msg_buf->in_use = true;
+  sys_slist_init(&dev_msg_buf->pkts);
+  dev_msg_buf->n_pkts = 0;
+  dev_msg_buf->claimed = false;
+
+  for (i = dev_index_hash(dev_id); dev_index[i] != NULL; i = (i + 1) & (DEV_INDEX_SIZE - 1))
+    ;
+  dev_index[i] = dev_msg_buf;
+
+  return dev_msg_buf;
+}
+
+/* Removes the buffer from the index and releases it. Must be called with index_lock held. */
+static void remove_dev_msg_buf(dev_msg_buf_t *dev_msg_buf) {
+  unsigned int i, j, home;
+
+  for (i = dev_index_hash(dev_msg_buf->dev_id); dev_index[i] != dev_msg_buf; i = (i + 1) & (DEV_INDEX_SIZE - 1))
+    ;
+
+  /* Backward shift deletion keeps probe sequences intact without tombstones */
+  for (j = (i + 1) & (DEV_INDEX_SIZE - 1); dev_index[j] != NULL; j = (j + 1) & (DEV_INDEX_SIZE - 1)) {
+    home = dev_index_hash(dev_index[j]->dev_id);
+    /* Move the entry into the gap, unless its home slot lies cyclically between the gap and the entry */
+    if (((j - home) & (DEV_INDEX_SIZE - 1)) >= ((j - i) & (DEV_INDEX_SIZE - 1))) {
+      dev_index[i] = dev_index[j];
+      i = j;
+    }
+  }
+  dev_index[i] = NULL;
+
+  dev_msg_buf->in_use = false;
+  free_bufs[n_free_bufs++] = dev_msg_buf;
+}
+
+/* Moves the packets of the device that match the predicate to the discarded list, except a claimed first packet.
+ * Must be called with index_lock held. */
+static void discard_pkts(dev_msg_buf_t *dev_msg_buf, sys_slist_t *discarded, bool (*pred)(queued_pkt_t *, int64_t),
+                         int64_t arg) {
+  sys_snode_t *prev = NULL;
+  sys_snode_t *node = sys_slist_peek_head(&dev_msg_buf->pkts);
+
+  if (dev_msg_buf->claimed) {
+    prev = node;
+    node = sys_slist_peek_next(node);
+  }
+
+  while (node != NULL) {
+    sys_snode_t *next = sys_slist_peek_next(node);
+    if (pred(CONTAINER_OF(node, queued_pkt_t, node), arg)) {
+      sys_slist_remove(&dev_msg_buf->pkts, prev, node);
+      sys_slist_append(discarded, node);
+      dev_msg_buf->n_pkts--;
+    } else
+      prev = node;
+    node = next;
+  }
+}
+
+static bool is_expired(queued_pkt_t *queued_pkt, int64_t now) {
+  return queued_pkt->expires <= now;
+}
+
+static bool is_replaceable(queued_pkt_t *queued_pkt, int64_t unused) {
+  return (queued_pkt->flags & MSG_FLAG_REPLACE) != 0;
+}
+
+/* Reports and frees discarded packets. Must be called without index_lock held. */
+static void release_discarded(sys_slist_t *discarded, uint8_t reason, msg_discard_cb_t discard_cb) {
+  sys_snode_t *node;
+
+  while ((node = sys_slist_get(discarded)) != NULL) {
+    queued_pkt_t *queued_pkt = CONTAINER_OF(node, queued_pkt_t, node);
+    LOG_DBG("Discarding packet %04X for 0x%08X: %u", queued_pkt->pkt.hdr.pkt_id, queued_pkt->pkt.hdr.dev_id, reason);
+    if (discard_cb != NULL)
+      discard_cb(queued_pkt->pkt.hdr.dev_id, queued_pkt->pkt.hdr.pkt_id, reason);
+    k_heap_free(&msg_pool, queued_pkt);
   }
-  return NULL;
 }
 
 int msg_buf_init(void) {
   for (unsigned int i = 0; i < MAX_NUM_DEVICES; i++) {
-    ring_buf_init(&buffers[i].msg_buf, PKTS_PER_BUF * sizeof(pkt_t), buffers[i].msg_buf_data);
     buffers[i].in_use = false;
+    free_bufs[i] = &buffers[i];
   }
+  n_free_bufs = MAX_NUM_DEVICES;
+
+  for (unsigned int i = 0; i < DEV_INDEX_SIZE; i++)
+    dev_index[i] = NULL;
+
   return 0;
 }
 
-int msg_buf_insert(pkt_t *pkt) {
+int msg_buf_insert(pkt_t *pkt, uint16_t ttl_s, uint8_t flags, msg_discard_cb_t discard_cb) {
   dev_msg_buf_t *dev_msg_buf;
+  queued_pkt_t *queued_pkt;
+  sys_slist_t replaced;
+  k_spinlock_key_t key;
+
+  if (pkt->len > (sizeof(pkt_t) - 1))
+    return -EINVAL;
 
+  /* Allocate only what the packet actually needs */
+  if ((queued_pkt = k_heap_alloc(&msg_pool, offsetof(queued_pkt_t, pkt) + pkt->len + 1, K_NO_WAIT)) == NULL)
+    return -ENOMEM;
+  memcpy(&queued_pkt->pkt, pkt, pkt->len + 1);
+  queued_pkt->expires = k_uptime_get() + (int64_t)(ttl_s ? ttl_s : MSG_DEFAULT_TTL_S) * 1000;
+  queued_pkt->flags = flags;
+  sys_slist_init(&replaced);
+
+  key = k_spin_lock(&index_lock);
   /* Search for a buffer that is already in use for this device id */
   if ((dev_msg_buf = get_dev_msg_buf(pkt->hdr.dev_id)) == NULL) {
     /* No buffer in use? Get a new one. */
-    if ((dev_msg_buf = get_empty_msg_buf()) == NULL)
+    if ((dev_msg_buf = add_dev_msg_buf(pkt->hdr.dev_id)) == NULL) {
       /* All buffers used*/
-      return -1;
-    /* Claim the empty buffer for this device id */
-    dev_msg_buf->dev_id = pkt->hdr.dev_id;
+      k_spin_unlock(&index_lock, key);
+      k_heap_free(&msg_pool, queued_pkt);
+      return -ENOSPC;
+    }
   }
 
-  LOG_DBG("Adding packet for 0x%08X to message buffer", dev_msg_buf->dev_id);
-  ring_buf_put(&dev_msg_buf->msg_buf, (uint8_t *)pkt, sizeof(pkt_t));
-  dev_msg_buf->in_use = true;
+  if (flags & MSG_FLAG_REPLACE)
+    discard_pkts(dev_msg_buf, &replaced, is_replaceable, 0);
+
+  if (dev_msg_buf->n_pkts >= MAX_PKTS_PER_DEVICE) {
+    k_spin_unlock(&index_lock, key);
+    k_heap_free(&msg_pool, queued_pkt);
+    /* Nothing has been replaced, otherwise there would be space */
+    return -ENOSPC;
+  }
 
+  if ((flags & MSG_FLAG_PRIORITY) && dev_msg_buf->claimed)
+    /* Right behind the packet that is being sent */
+    sys_slist_insert(&dev_msg_buf->pkts, sys_slist_peek_head(&dev_msg_buf->pkts), &queued_pkt->node);
+  else if (flags & MSG_FLAG_PRIORITY)
+    sys_slist_prepend(&dev_msg_buf->pkts, &queued_pkt->node);
+  else
+    sys_slist_append(&dev_msg_buf->pkts, &queued_pkt->node);
+  dev_msg_buf->n_pkts++;
+  k_spin_unlock(&index_lock, key);
+
+  release_discarded(&replaced, MSG_DISCARD_REPLACED, discard_cb);
+
+  LOG_DBG("Adding packet for 0x%08X to message buffer", pkt->hdr.dev_id);
   return 0;
 }
 
 /* This gets called from a critical section within the radio ISR and should run as quickly as possible */
 int msg_buf_get_claim(pkt_t **dst, uint32_t dev_id) {
   dev_msg_buf_t *dev_msg_buf;
-  size_t rb_size;
+
   if ((dev_msg_buf = get_dev_msg_buf(dev_id)) == NULL)
     /* No messages available for this device id*/
     return 1;
 
-  if ((rb_size = ring_buf_get_claim(&dev_msg_buf->msg_buf, (uint8_t **)dst, sizeof(pkt_t))) != sizeof(pkt_t)) {
-    /* This shouldn't happen*/
-    return -1;
-  }
-
+  /* Buffers in the index always hold at least one packet */
+  *dst = &CONTAINER_OF(sys_slist_peek_head(&dev_msg_buf->pkts), queued_pkt_t, node)->pkt;
+  dev_msg_buf->claimed = true;
   return 0;
 }
 
 int msg_buf_get_finish(uint32_t dev_id) {
   dev_msg_buf_t *dev_msg_buf;
+  sys_snode_t *node;
+  k_spinlock_key_t key = k_spin_lock(&index_lock);
 
-  if ((dev_msg_buf = get_dev_msg_buf(dev_id)) == NULL)
+  if ((dev_msg_buf = get_dev_msg_buf(dev_id)) == NULL) {
     /* This should not happen, since we should have claimed before */
+    k_spin_unlock(&index_lock, key);
     return -1;
+  }
 
-  ring_buf_get_finish(&dev_msg_buf->msg_buf, sizeof(pkt_t));
+  node = sys_slist_get(&dev_msg_buf->pkts);
+  dev_msg_buf->claimed = false;
+  if (--dev_msg_buf->n_pkts == 0)
+    remove_dev_msg_buf(dev_msg_buf);
+  k_spin_unlock(&index_lock, key);
 
-  if (ring_buf_is_empty(&dev_msg_buf->msg_buf))
-    dev_msg_buf->in_use = false;
-  LOG_DBG("Retrieved packet for 0x%08X from message buffer", dev_msg_buf->dev_id);
+  k_heap_free(&msg_pool, CONTAINER_OF(node, queued_pkt_t, node));
 
+  LOG_DBG("Retrieved packet for 0x%08X from message buffer", dev_id);
   return 0;
-}
\ No newline at end of file
+}
+
+void msg_buf_sweep(msg_discard_cb_t discard_cb) {
+  sys_slist_t expired;
+  k_spinlock_key_t key;
+  int64_t now = k_uptime_get();
+
+  sys_slist_init(&expired);
+
+  /* Only hold the lock for one device at a time to keep the radio ISR latency low */
+  for (unsigned int i = 0; i < MAX_NUM_DEVICES; i++) {
+    key = k_spin_lock(&index_lock);
+    if (buffers[i].in_use) {
+      discard_pkts(&buffers[i], &expired, is_expired, now);
+      if (buffers[i].n_pkts == 0)
+        remove_dev_msg_buf(&buffers[i]);
+    }
+    k_spin_unlock(&index_lock, key);
+  }
+
+  release_discarded(&expired, MSG_DISCARD_EXPIRED, discard_cb);
+}
@@ -1,7 +1,7 @@
 #ifndef __MESSAGE_BUFFER_H_
 #define __MESSAGE_BUFFER_H_
 
-#include "radio.h"
+#include "packet.h"
 #include <stdint.h>
 
 #define MSG_PAYLOAD_SIZE 247
@@ -16,8 +16,32 @@ typedef struct {
   uint8_t data[MSG_PAYLOAD_SIZE];
 } msg_t;
 
+/* Options for queued packets */
+enum {
+  /* Send before the other packets queued for the device */
+  MSG_FLAG_PRIORITY = 0x01,
+  /* Supersedes the packets queued for the device that also have this flag, e.g. an updated configuration */
+  MSG_FLAG_REPLACE = 0x02,
+};
+
+/* Reasons for discarding a packet before it was delivered */
+enum {
+  MSG_DISCARD_EXPIRED = 0,
+  MSG_DISCARD_REPLACED = 1,
+};
+
+/* Time to live of packets if none is specified */
+#define MSG_DEFAULT_TTL_S 600
+
+/* Called outside of critical sections for every packet that is discarded from the message buffer */
+typedef void (*msg_discard_cb_t)(uint32_t dev_id, uint16_t pkt_id, uint8_t reason);
+
 int msg_buf_init(void);
-int msg_buf_insert(pkt_t *pkt);
+/* Queue a packet for the device that is discarded if not delivered within ttl_s seconds. Returns -ENOSPC if the
+ * device's queue is full and -ENOMEM if the pool is exhausted. */
+int msg_buf_insert(pkt_t *pkt, uint16_t ttl_s, uint8_t flags, msg_discard_cb_t discard_cb);
+/* Discards expired packets and releases the buffers of devices without pending packets */
+void msg_buf_sweep(msg_discard_cb_t discard_cb);
 
 /* Get a pointer to a packet for the device from the message buffer */
 int msg_buf_get_claim(pkt_t **dst, uint32_t dev_id);
@@ -0,0 +1,25 @@
+#ifndef __MESSAGE_BUFFER_PRIV_H_
+#define __MESSAGE_BUFFER_PRIV_H_
+
+#include <stdint.h>
+
+/* Internals of message_buffer.c, shared with its host tests */
+
+/* Maximum number of devices with pending packets */
+#define MAX_NUM_DEVICES 256
+/* Maximum number of pending packets per device, so that a single device cannot exhaust the pool */
+#define MAX_PKTS_PER_DEVICE 64
+/* Size of the pool shared by all pending packets */
+#define MSG_POOL_SIZE (64 * 1024)
+
+/* The device index has 2^DEV_INDEX_BITS slots. Keeping it at most 25% full keeps probe sequences short. */
+#define DEV_INDEX_BITS 10
+#define DEV_INDEX_SIZE (1UL << DEV_INDEX_BITS)
+
+/* Home slot of the device ID in the device index */
+static inline unsigned int dev_index_hash(uint32_t dev_id) {
+  /* Fibonacci hashing spreads consecutive device IDs across the table */
+  return (uint32_t)(dev_id * 2654435769U) >> (32 - DEV_INDEX_BITS);
+}
+
+#endif /* __MESSAGE_BUFFER_PRIV_H_ */
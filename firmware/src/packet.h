@@ -0,0 +1,26 @@
+#ifndef __PACKET_H_
+#define __PACKET_H_
+
+#include <stdint.h>
+
+/* Max payload size is 255. We have 8 Byte protocol overhead. */
+#define PKT_PAYLOAD_SIZE (255 - sizeof(pkt_header_t))
+
+typedef struct __attribute__((packed)) {
+  /* This is always the ID of the 'station' device sending or receiving the packet */
+  uint32_t dev_id;
+  /* ID of the packet */
+  uint16_t pkt_id;
+  /* ID of a previous packet that is acknowledged with this packet */
+  uint16_t ack_id;
+} pkt_header_t;
+
+typedef struct __attribute__((packed)) {
+  /* Lenght of the packet, excluding this one byte length field */
+  uint8_t len;
+  pkt_header_t hdr;
+  /* Max payload size is 255. We have 8 Byte protocol overhead. */
+  uint8_t data[PKT_PAYLOAD_SIZE];
+} pkt_t;
+
+#endif /* __PACKET_H_ */
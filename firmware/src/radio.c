@@ -8,22 +8,44 @@
 #include <zephyr/kernel.h>
 
 #include "message_buffer.h"
+#include "radio.h"
+#include "stats.h"
+#include "timestamp.h"
 
 #define PKT_MQ_CAPACITY 16
-#define RADIO_STACK_SIZE 1024
+/* One buffer is armed for reception and one is being processed by the application */
+#define RX_POOL_SIZE (PKT_MQ_CAPACITY + 2)
 
-K_MSGQ_DEFINE(pkt_mq, sizeof(pkt_t), PKT_MQ_CAPACITY, 4);
+/* Pool of DMA buffers for incoming radio packets */
+K_MEM_SLAB_DEFINE_STATIC(rx_pool, sizeof(rx_pkt_t), RX_POOL_SIZE, 8);
 
-/* Structure for the radio handler thread that fills the pkt_mq */
-K_THREAD_STACK_DEFINE(radio_thread_stack, RADIO_STACK_SIZE);
-struct k_thread radio_thread_data;
+/* Hands received packets from the radio ISR to the application by pointer */
+K_MSGQ_DEFINE(pkt_mq, sizeof(rx_pkt_t *), PKT_MQ_CAPACITY, 4);
 
-/* DMA buffer for incoming radio packets */
-static pkt_t rx_pkt;
+#define DELIVERED_MQ_CAPACITY 16
+/* Reports downlink packets that were sent as acknowledgement to the application */
+K_MSGQ_DEFINE(delivered_mq, sizeof(radio_delivered_t), DELIVERED_MQ_CAPACITY, 4);
+
+/* DMA buffer currently armed for incoming radio packets */
+static rx_pkt_t *rx_pkt;
+
+/* Device and packet ID of the packet that was claimed from the message buffer for the current acknowledgement */
+static radio_delivered_t claimed_pkt;
+static bool claimed;
 
 /* Buffer for outgoing acknowledgement packets in case no other packets are to be sent */
 static pkt_t ack_only_pkt;
 
+/* Active data rate and channel schedule */
+static radio_cfg_t radio_cfg = {.rate = RADIO_RATE_BLE_1MBIT, .dwell_ms = 0, .n_channels = 1, .channels = {76}};
+/* Index of the channel in the schedule that the radio listens on */
+static unsigned int channel_idx;
+/* Delay before retrying a channel switch that was postponed because a packet was being received */
+#define CHANNEL_SWITCH_RETRY_MS 1
+
+static void channel_switch_handler(struct k_timer *timer);
+K_TIMER_DEFINE(channel_timer, channel_switch_handler, NULL);
+
 enum {
   /* Uplink logical address index */
   LA_UPLINK_IDX = 1,
@@ -38,15 +60,6 @@ enum {
   LA_DOWNLINK = 0xF7,
 };
 
-/* Used to signal from the radio ISR to the handler thread */
-enum {
-  RADIO_EVT_CRCOK = (1UL << 0),
-  RADIO_EVT_CLAIM = (1UL << 1),
-  RADIO_EVT_END = (1UL << 2),
-};
-
-K_EVENT_DEFINE(radio_evt);
-
 ISR_DIRECT_DECLARE(radio_isr) {
   if ((NRF_RADIO->EVENTS_TXREADY == 1) && (NRF_RADIO->INTENSET & RADIO_INTENSET_TXREADY_Msk)) {
     NRF_RADIO->EVENTS_TXREADY = 0;
@@ -60,6 +73,8 @@ ISR_DIRECT_DECLARE(radio_isr) {
   }
   if ((NRF_RADIO->EVENTS_RXREADY == 1) && (NRF_RADIO->INTENSET & RADIO_INTENSET_RXREADY_Msk)) {
     NRF_RADIO->EVENTS_RXREADY = 0;
+    /* Used to tell whether a packet is being received when switching channels */
+    NRF_RADIO->EVENTS_ADDRESS = 0;
 
     /* Set shorts for turning around to TX to send acknowledgement */
     NRF_RADIO->SHORTS &= ~RADIO_SHORTS_DISABLED_RXEN_Msk;
@@ -72,12 +87,18 @@ ISR_DIRECT_DECLARE(radio_isr) {
     NRF_RADIO->EVENTS_END = 0;
 
     /* Prepare for listening again */
-    NRF_RADIO->PACKETPTR = (uint32_t)&rx_pkt;
+    NRF_RADIO->PACKETPTR = (uint32_t)&rx_pkt->pkt;
     NRF_RADIO->INTENCLR = 0xFFFFFFFF;
     NRF_RADIO->INTENSET = RADIO_INTENSET_RXREADY_Msk;
 
-    /* Notify application that the acknowledgement has been sent */
-    k_event_post(&radio_evt, RADIO_EVT_END);
+    /* If the acknowledgement packet has been taken from the message buffer */
+    if (claimed) {
+      /* Tell the buffer that we're done with the packet */
+      msg_buf_get_finish(claimed_pkt.dev_id);
+      claimed = false;
+      if (k_msgq_put(&delivered_mq, &claimed_pkt, K_NO_WAIT) != 0)
+        stats_inc(STATS_DELIVERED_DROPPED);
+    }
     /* Ask the scheduler to do its job */
     return 1;
   }
@@ -86,35 +107,52 @@ ISR_DIRECT_DECLARE(radio_isr) {
     NRF_RADIO->EVENTS_CRCOK = 0;
 
     pkt_t* tx_pkt;
+    rx_pkt_t* rx_next;
+
     /* Get a packet that is to be sent to the device from which we just received something */
-    if (msg_buf_get_claim(&tx_pkt, rx_pkt.hdr.dev_id) == 0)
-      /* Let the application know that we have claimed a buffer */
-      k_event_post(&radio_evt, RADIO_EVT_CLAIM);
-    else {
+    if (msg_buf_get_claim(&tx_pkt, rx_pkt->pkt.hdr.dev_id) == 0) {
+      /* Remember that we have claimed a buffer */
+      claimed_pkt.dev_id = rx_pkt->pkt.hdr.dev_id;
+      claimed_pkt.pkt_id = tx_pkt->hdr.pkt_id;
+      claimed = true;
+    } else {
       /* If there is no packet pending, send an empty acknowledgement */
       tx_pkt = &ack_only_pkt;
       /* Acknowledgements always have the same device ID as the acknowledged packet */
-      tx_pkt->hdr.dev_id = rx_pkt.hdr.dev_id;
+      tx_pkt->hdr.dev_id = rx_pkt->pkt.hdr.dev_id;
     }
 
     /* Insert Packet ID of received packet into acknowledgement */
-    tx_pkt->hdr.ack_id = rx_pkt.hdr.pkt_id;
+    tx_pkt->hdr.ack_id = rx_pkt->pkt.hdr.pkt_id;
     /* Insert destination ID into acknowledgement */
-    tx_pkt->hdr.dev_id = rx_pkt.hdr.dev_id;
+    tx_pkt->hdr.dev_id = rx_pkt->pkt.hdr.dev_id;
 
     NRF_RADIO->PACKETPTR = (uint32_t)tx_pkt;
 
     NRF_RADIO->INTENCLR = 0xFFFFFFFF;
     NRF_RADIO->INTENSET = RADIO_INTENSET_TXREADY_Msk;
 
-    /* Notify application that it can pick up the received packet */
-    k_event_post(&radio_evt, RADIO_EVT_CRCOK);
+    /* The timer was captured via PPI when the address of this packet was matched */
+    rx_pkt->timestamp = timestamp_rx_get();
+
+    /* Hand the received packet over to the application and rotate in a fresh buffer for the next reception. If no
+     * buffer is available, the packet is dropped and its buffer is reused. */
+    stats_inc(STATS_RX_OK);
+    if (k_mem_slab_alloc(&rx_pool, (void **)&rx_next, K_NO_WAIT) != 0)
+      stats_inc(STATS_RX_DROPPED);
+    else if (k_msgq_put(&pkt_mq, &rx_pkt, K_NO_WAIT) != 0) {
+      k_mem_slab_free(&rx_pool, rx_next);
+      stats_inc(STATS_RX_DROPPED);
+    } else
+      rx_pkt = rx_next;
+
     /* Ask the scheduler to do its job */
     return 1;
   }
   /* Bad CRC -> Abort transmission of Acknowledgement*/
   if ((NRF_RADIO->EVENTS_CRCERROR == 1) && (NRF_RADIO->INTENSET & RADIO_INTENSET_CRCERROR_Msk)) {
     NRF_RADIO->EVENTS_CRCERROR = 0;
+    stats_inc(STATS_RX_CRC_ERROR);
 
     /* Set shorts for turning around to RX */
     NRF_RADIO->SHORTS &= ~RADIO_SHORTS_DISABLED_TXEN_Msk;
@@ -129,13 +167,83 @@ ISR_DIRECT_DECLARE(radio_isr) {
   return 0;
 }
 
+/* Write channel and data rate. Takes effect at the next ramp-up of the radio. */
+static void radio_apply(uint8_t channel, uint8_t rate) {
+  NRF_RADIO->FREQUENCY = channel;
+  if (rate == RADIO_RATE_BLE_2MBIT) {
+    NRF_RADIO->MODE = (RADIO_MODE_MODE_Ble_2Mbit << RADIO_MODE_MODE_Pos);
+    /* BLE 2MBit uses a two byte preamble */
+    NRF_RADIO->PCNF0 = (NRF_RADIO->PCNF0 & ~RADIO_PCNF0_PLEN_Msk) | (RADIO_PCNF0_PLEN_16bit << RADIO_PCNF0_PLEN_Pos);
+  } else {
+    NRF_RADIO->MODE = (RADIO_MODE_MODE_Ble_1Mbit << RADIO_MODE_MODE_Pos);
+    NRF_RADIO->PCNF0 = (NRF_RADIO->PCNF0 & ~RADIO_PCNF0_PLEN_Msk) | (RADIO_PCNF0_PLEN_8bit << RADIO_PCNF0_PLEN_Pos);
+  }
+}
+
+/* Moves the radio to the channel at channel_idx if it is waiting for a packet. Returns -EBUSY otherwise. */
+static int radio_switch_channel(void) {
+  unsigned int key = irq_lock();
+
+  /* Only switch while listening and before an address has been matched, i.e. never during a reception or the
+   * transmission of an acknowledgement */
+  if ((NRF_RADIO->STATE != RADIO_STATE_STATE_Rx) || (NRF_RADIO->EVENTS_ADDRESS == 1) ||
+      !(NRF_RADIO->INTENSET & RADIO_INTENSET_CRCOK_Msk)) {
+    irq_unlock(key);
+    return -EBUSY;
+  }
+
+  radio_apply(radio_cfg.channels[channel_idx], radio_cfg.rate);
+
+  /* Same as after a CRC error: turn around to RX and ramp up on the new channel */
+  NRF_RADIO->SHORTS &= ~RADIO_SHORTS_DISABLED_TXEN_Msk;
+  NRF_RADIO->SHORTS |= RADIO_SHORTS_DISABLED_RXEN_Msk;
+  NRF_RADIO->INTENCLR = 0xFFFFFFFF;
+  NRF_RADIO->INTENSET = RADIO_INTENSET_RXREADY_Msk;
+  NRF_RADIO->TASKS_DISABLE = 1;
+
+  irq_unlock(key);
+  return 0;
+}
+
+static void channel_switch_handler(struct k_timer *timer) {
+  if (radio_switch_channel() != 0) {
+    k_timer_start(&channel_timer, K_MSEC(CHANNEL_SWITCH_RETRY_MS), K_NO_WAIT);
+    return;
+  }
+
+  /* Schedule the next hop */
+  if (radio_cfg.n_channels > 1) {
+    channel_idx = (channel_idx + 1) % radio_cfg.n_channels;
+    k_timer_start(&channel_timer, K_MSEC(radio_cfg.dwell_ms), K_NO_WAIT);
+  }
+}
+
+int radio_configure(const radio_cfg_t *cfg) {
+  if ((cfg->rate != RADIO_RATE_BLE_1MBIT) && (cfg->rate != RADIO_RATE_BLE_2MBIT))
+    return -EINVAL;
+  if ((cfg->n_channels == 0) || (cfg->n_channels > RADIO_MAX_CHANNELS))
+    return -EINVAL;
+  if ((cfg->n_channels > 1) && (cfg->dwell_ms == 0))
+    return -EINVAL;
+  for (unsigned int i = 0; i < cfg->n_channels; i++) {
+    if (cfg->channels[i] > RADIO_CHANNEL_MAX)
+      return -EINVAL;
+  }
+
+  k_timer_stop(&channel_timer);
+  radio_cfg = *cfg;
+  channel_idx = 0;
+  k_timer_start(&channel_timer, K_NO_WAIT, K_NO_WAIT);
+  return 0;
+}
+
+void radio_get_config(radio_cfg_t *cfg) {
+  *cfg = radio_cfg;
+}
+
 int radio_init() {
   /* 0dBm TX power */
   NRF_RADIO->TXPOWER = (RADIO_TXPOWER_TXPOWER_0dBm << RADIO_TXPOWER_TXPOWER_Pos);
-  /* 2450 MHz frequency */
-  NRF_RADIO->FREQUENCY = 76UL;
-  /* BLE 2MBit */
-  NRF_RADIO->MODE = (RADIO_MODE_MODE_Ble_1Mbit << RADIO_MODE_MODE_Pos);
   /* Fast radio rampup */
   NRF_RADIO->MODECNF0 = (RADIO_MODECNF0_RU_Fast << RADIO_MODECNF0_RU_Pos);
 
@@ -153,6 +261,9 @@ int radio_init() {
   NRF_RADIO->PCNF0 = (0 << RADIO_PCNF0_S1LEN_Pos) | (0 << RADIO_PCNF0_S0LEN_Pos) | (8 << RADIO_PCNF0_LFLEN_Pos) |
                      (RADIO_PCNF0_PLEN_8bit << RADIO_PCNF0_PLEN_Pos);
 
+  /* 2476 MHz, BLE 1MBit by default */
+  radio_apply(radio_cfg.channels[0], radio_cfg.rate);
+
   /* No whitening, little endian, 2B base address, 4B payload */
   NRF_RADIO->PCNF1 = (RADIO_PCNF1_WHITEEN_Disabled << RADIO_PCNF1_WHITEEN_Pos) |
                      (RADIO_PCNF1_ENDIAN_Little << RADIO_PCNF1_ENDIAN_Pos) | (2 << RADIO_PCNF1_BALEN_Pos) |
@@ -180,38 +291,21 @@ int radio_init() {
   return 0;
 }
 
-/* This thread processes the radio events to offload work from the ISR. */
-static void radio_handler() {
-  pkt_t tmp_buf;
-  while (1) {
-    /* Wait until a valid packet is received */
-    k_event_wait(&radio_evt, RADIO_EVT_CRCOK, false, K_FOREVER);
-    /* Copy received packet into buffer to immediately free the receive buffer */
-    memcpy(&tmp_buf, &rx_pkt, rx_pkt.len + 1);
-
-    /* Wait until acknowledgement has been sent */
-    k_event_wait(&radio_evt, RADIO_EVT_END, false, K_FOREVER);
-
-    /* If the acknowledgement packet has been taken from the message buffer*/
-    if (radio_evt.events & RADIO_EVT_CLAIM)
-      /* Tell the buffer that we're done with the packet */
-      msg_buf_get_finish(tmp_buf.hdr.dev_id);
-
-    /* Send last received packet to application for processing */
-    k_msgq_put(&pkt_mq, &tmp_buf, K_NO_WAIT);
+int radio_msgq_get(rx_pkt_t** pkt, k_timeout_t timeout) {
+  return k_msgq_get(&pkt_mq, pkt, timeout);
+}
 
-    k_event_clear(&radio_evt, 0xFFFFFFFF);
-  }
+void radio_pkt_free(rx_pkt_t* pkt) {
+  k_mem_slab_free(&rx_pool, pkt);
 }
 
-int radio_msgq_get(pkt_t* pkt, k_timeout_t timeout) {
-  return k_msgq_get(&pkt_mq, pkt, timeout);
+int radio_delivered_get(radio_delivered_t* delivered, k_timeout_t timeout) {
+  return k_msgq_get(&delivered_mq, delivered, timeout);
 }
 
 int radio_start() {
-  /* Thread has high priority */
-  k_thread_create(&radio_thread_data, radio_thread_stack, K_THREAD_STACK_SIZEOF(radio_thread_stack), radio_handler,
-                  NULL, NULL, NULL, 1, 0, K_NO_WAIT);
+  if (k_mem_slab_alloc(&rx_pool, (void**)&rx_pkt, K_NO_WAIT) != 0)
+    return -1;
 
   /* If it's not running, start the HFCLCK */
   if ((NRF_CLOCK->HFCLKSTAT & (CLOCK_HFCLKSTAT_SRC_Xtal << CLOCK_HFCLKSTAT_SRC_Pos)) == 0) {
@@ -224,7 +318,7 @@ int radio_start() {
     NRF_CLOCK->EVENTS_HFCLKSTARTED = 0;
   }
 
-  NRF_RADIO->PACKETPTR = (uint32_t)&rx_pkt;
+  NRF_RADIO->PACKETPTR = (uint32_t)&rx_pkt->pkt;
   NRF_RADIO->INTENSET = RADIO_INTENSET_RXREADY_Msk;
   NRF_RADIO->TASKS_RXEN = 1;
 
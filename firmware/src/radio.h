@@ -1,29 +1,58 @@
 #ifndef __RADIO_H_
 #define __RADIO_H_
 
-int radio_init();
-int radio_start();
+#include <zephyr/kernel.h>
+
+#include "packet.h"
 
-/* Max payload size is 255. We have 8 Byte protocol overhead. */
-#define PKT_PAYLOAD_SIZE (255 - sizeof(pkt_header_t))
+/* Maximum number of channels in a listening schedule */
+#define RADIO_MAX_CHANNELS 8
+/* Highest channel, i.e. 2500 MHz */
+#define RADIO_CHANNEL_MAX 100
+
+/* Data rates */
+enum {
+  RADIO_RATE_BLE_1MBIT = 0,
+  RADIO_RATE_BLE_2MBIT = 1,
+};
 
 typedef struct __attribute__((packed)) {
-  /* This is always the ID of the 'station' device sending or receiving the packet */
+  uint8_t rate;
+  /* Time spent listening on each channel if more than one channel is configured */
+  uint16_t dwell_ms;
+  uint8_t n_channels;
+  /* Channels as offsets from 2400 MHz in MHz */
+  uint8_t channels[RADIO_MAX_CHANNELS];
+} radio_cfg_t;
+
+/* Received packet together with the time of its reception */
+typedef struct {
+  /* Must be the first member, because the radio writes the packet to the start of the buffer */
+  pkt_t pkt;
+  /* Time of the address match in microseconds since boot */
+  uint64_t timestamp;
+} rx_pkt_t;
+
+/* Downlink packet that was sent to its device as acknowledgement */
+typedef struct {
   uint32_t dev_id;
-  /* ID of the packet */
   uint16_t pkt_id;
-  /* ID of a previous packet that is acknowledged with this packet */
-  uint16_t ack_id;
-} pkt_header_t;
+} radio_delivered_t;
 
-typedef struct __attribute__((packed)) {
-  /* Lenght of the packet, excluding this one byte length field */
-  uint8_t len;
-  pkt_header_t hdr;
-  /* Max payload size is 255. We have 8 Byte protocol overhead. */
-  uint8_t data[PKT_PAYLOAD_SIZE];
-} pkt_t;
-
-int radio_msgq_get(pkt_t* pkt, k_timeout_t timeout);
+int radio_init();
+int radio_start();
+
+/* Switch to a new data rate and channel schedule. The radio changes channel only while it is waiting for a packet. */
+int radio_configure(const radio_cfg_t* cfg);
+/* Get the active configuration */
+void radio_get_config(radio_cfg_t* cfg);
+
+/* Get a pointer to the next received packet. The packet must be returned with radio_pkt_free(). */
+int radio_msgq_get(rx_pkt_t** pkt, k_timeout_t timeout);
+/* Return a received packet to the pool of radio DMA buffers */
+void radio_pkt_free(rx_pkt_t* pkt);
+
+/* Get the next downlink packet that was delivered */
+int radio_delivered_get(radio_delivered_t* delivered, k_timeout_t timeout);
 
 #endif /* __RADIO_H_ */
\ No newline at end of file
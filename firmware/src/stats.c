@@ -0,0 +1,3 @@
+#include "stats.h"
+
+atomic_t stats[STATS_NUM];
@@ -0,0 +1,37 @@
+#ifndef __STATS_H_
+#define __STATS_H_
+
+#include <zephyr/sys/atomic.h>
+
+/* Counters for the stages of the packet pipeline. The order is part of the protocol with the host. */
+enum {
+  /* Packets received by the radio with valid CRC */
+  STATS_RX_OK,
+  /* Packets received by the radio with invalid CRC */
+  STATS_RX_CRC_ERROR,
+  /* Received packets dropped because no RX buffer or queue entry was available */
+  STATS_RX_DROPPED,
+  /* Frames dropped because the CDC ACM TX ringbuffer was full */
+  STATS_TX_RING_DROPPED,
+  /* Frames from the host dropped because no downlink buffer was available */
+  STATS_DOWNLINK_DROPPED,
+  /* Packets from the host that could not be queued in the message buffer */
+  STATS_DOWNLINK_REJECTED,
+  /* Delivery notifications dropped because the application did not keep up */
+  STATS_DELIVERED_DROPPED,
+  /* Frames from the host dropped because they were garbled, oversized or not terminated */
+  STATS_DOWNLINK_FRAME_ERRORS,
+  STATS_NUM,
+};
+
+extern atomic_t stats[STATS_NUM];
+
+static inline void stats_inc(unsigned int counter) {
+  atomic_inc(&stats[counter]);
+}
+
+static inline void stats_add(unsigned int counter, atomic_val_t n) {
+  atomic_add(&stats[counter], n);
+}
+
+#endif /* __STATS_H_ */
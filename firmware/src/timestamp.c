@@ -0,0 +1,78 @@
+#include <nrf.h>
+
+#include <zephyr/kernel.h>
+
+#include "timestamp.h"
+
+/* TIMER2 counts microseconds. TIMER0 and TIMER1 are left to Zephyr and the SoftDevice Controller. */
+#define TS_TIMER NRF_TIMER2
+#define TS_TIMER_IRQn TIMER2_IRQn
+
+/* PPI channel that captures the timer on the radio ADDRESS event. No other part of the firmware uses PPI. */
+#define TS_PPI_CH 0
+
+enum {
+  /* Captured by the radio ADDRESS event via PPI */
+  CC_RX = 0,
+  /* Compare at 0 to count overflows of the 32-bit counter */
+  CC_WRAP = 1,
+  /* Captured by software to read the current time */
+  CC_NOW = 2,
+};
+
+/* Upper 32 bit of the 64-bit microsecond time */
+static volatile uint32_t wraps;
+
+static void timestamp_isr(const void *arg) {
+  if (TS_TIMER->EVENTS_COMPARE[CC_WRAP] == 1) {
+    TS_TIMER->EVENTS_COMPARE[CC_WRAP] = 0;
+    wraps++;
+  }
+}
+
+uint64_t timestamp_get(void) {
+  uint32_t hi, lo;
+  unsigned int key = irq_lock();
+
+  TS_TIMER->TASKS_CAPTURE[CC_NOW] = 1;
+  lo = TS_TIMER->CC[CC_NOW];
+  hi = wraps;
+  /* The counter wrapped, but the interrupt has not been served yet */
+  if ((TS_TIMER->EVENTS_COMPARE[CC_WRAP] == 1) && (lo < 0x80000000UL))
+    hi++;
+
+  irq_unlock(key);
+  return ((uint64_t)hi << 32) | lo;
+}
+
+uint64_t timestamp_rx_get(void) {
+  uint32_t captured = TS_TIMER->CC[CC_RX];
+  uint64_t now = timestamp_get();
+
+  /* The capture happened before now. If its lower half is larger, the counter has wrapped in between. */
+  if (captured > (uint32_t)now)
+    now -= 1ULL << 32;
+  return (now & 0xFFFFFFFF00000000ULL) | captured;
+}
+
+int timestamp_init(void) {
+  TS_TIMER->TASKS_STOP = 1;
+  TS_TIMER->MODE = (TIMER_MODE_MODE_Timer << TIMER_MODE_MODE_Pos);
+  TS_TIMER->BITMODE = (TIMER_BITMODE_BITMODE_32Bit << TIMER_BITMODE_BITMODE_Pos);
+  /* 16 MHz / 2^4 = 1 MHz */
+  TS_TIMER->PRESCALER = 4;
+  TS_TIMER->CC[CC_WRAP] = 0;
+  TS_TIMER->EVENTS_COMPARE[CC_WRAP] = 0;
+  TS_TIMER->INTENSET = TIMER_INTENSET_COMPARE1_Msk;
+
+  IRQ_CONNECT(TS_TIMER_IRQn, 1, timestamp_isr, NULL, 0);
+  irq_enable(TS_TIMER_IRQn);
+
+  NRF_PPI->CH[TS_PPI_CH].EEP = (uint32_t)&NRF_RADIO->EVENTS_ADDRESS;
+  NRF_PPI->CH[TS_PPI_CH].TEP = (uint32_t)&TS_TIMER->TASKS_CAPTURE[CC_RX];
+  NRF_PPI->CHENSET = (1UL << TS_PPI_CH);
+
+  TS_TIMER->TASKS_CLEAR = 1;
+  TS_TIMER->TASKS_START = 1;
+  return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef __TIMESTAMP_H_
+#define __TIMESTAMP_H_
+
+#include <stdint.h>
+
+/* Starts the microsecond timer and connects the radio ADDRESS event to its capture task */
+int timestamp_init(void);
+
+/* Current time in microseconds since timestamp_init() */
+uint64_t timestamp_get(void);
+
+/* Time in microseconds of the last radio ADDRESS event. Must be called before the next packet can be received. */
+uint64_t timestamp_rx_get(void);
+
+#endif /* __TIMESTAMP_H_ */
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "base64.h"
+#include "cobs.h"
+#include "framing.h"
+#include "test.h"
+
+#define N_ROUNDS 20000
+
+static const char base64_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+/* Decoder before the reverse lookup table, which searches the alphabet for every character and does not validate the
+ * input */
+static int legacy_base64_decode(unsigned char *output, size_t output_size, char *input, size_t length) {
+  int i, j;
+  int padding = 0;
+
+  size_t decoded_length = (length * 3) / 4;  // Calculate the maximum decoded length
+
+  if (input[length - 1] == '=') {
+    padding++;
+    if (input[length - 2] == '=')
+      padding++;
+  }
+
+  if (output_size < (decoded_length - padding))
+    return -1;
+
+  for (i = 0, j = 0; i < length; i += 4) {
+    unsigned char a = strchr(base64_table, input[i]) - base64_table;
+    unsigned char b = strchr(base64_table, input[i + 1]) - base64_table;
+    unsigned char c = strchr(base64_table, input[i + 2]) - base64_table;
+    unsigned char d = strchr(base64_table, input[i + 3]) - base64_table;
+
+    output[j++] = (a << 2) | (b >> 4);
+    if (input[i + 2] != '=')
+      output[j++] = (b << 4) | (c >> 2);
+    if (input[i + 3] != '=')
+      output[j++] = (c << 6) | d;
+  }
+
+  return j;
+}
+
+static void bench_base64(void) {
+  static uint8_t plain[PKT_PAYLOAD_SIZE], decoded[PKT_PAYLOAD_SIZE];
+  static char encoded[PKT_FRAME_MAX_SIZE];
+  base64_stream_t s;
+  uint64_t t0;
+  int n = 0;
+
+  for (size_t i = 0; i < sizeof(plain); i++)
+    plain[i] = rand();
+
+  t0 = now_ns();
+  for (int r = 0; r < N_ROUNDS; r++)
+    n = base64_encode(encoded, sizeof(encoded), plain, sizeof(plain));
+  bench_report("base64_encode (247 B)", N_ROUNDS, (uint64_t)N_ROUNDS * sizeof(plain), now_ns() - t0);
+
+  t0 = now_ns();
+  for (int r = 0; r < N_ROUNDS; r++) {
+    if (legacy_base64_decode(decoded, sizeof(decoded), encoded, n) != sizeof(plain))
+      abort();
+  }
+  bench_report("legacy base64_decode (247 B)", N_ROUNDS, (uint64_t)N_ROUNDS * sizeof(plain), now_ns() - t0);
+  if (memcmp(decoded, plain, sizeof(plain)) != 0)
+    abort();
+
+  t0 = now_ns();
+  for (int r = 0; r < N_ROUNDS; r++) {
+    base64_stream_init(&s, decoded, sizeof(decoded));
+    for (int i = 0; i < n; i++)
+      base64_stream_put(&s, encoded[i]);
+    if (base64_stream_finish(&s) != sizeof(plain))
+      abort();
+  }
+  bench_report("base64_stream_put (247 B)", N_ROUNDS, (uint64_t)N_ROUNDS * sizeof(plain), now_ns() - t0);
+  if (memcmp(decoded, plain, sizeof(plain)) != 0)
+    abort();
+}
+
+static void bench_cobs(void) {
+  /* Largest raw frame, i.e. a packet with timestamp and trailer */
+  static uint8_t input[1 + sizeof(int64_t) + sizeof(pkt_t) + FRAME_TRAILER_SIZE];
+  static uint8_t encoded[COBS_ENCODED_SIZE(sizeof(input))];
+  uint64_t t0;
+
+  for (size_t i = 0; i < sizeof(input); i++)
+    input[i] = (rand() % 8 == 0) ? 0 : rand();
+
+  t0 = now_ns();
+  for (int r = 0; r < N_ROUNDS; r++) {
+    if (cobs_encode(encoded, sizeof(encoded), input, sizeof(input)) < 0)
+      abort();
+  }
+  bench_report("cobs_encode (max frame)", N_ROUNDS, (uint64_t)N_ROUNDS * sizeof(input), now_ns() - t0);
+}
+
+static void bench_framing(void) {
+  static uint8_t frame[PKT_FRAME_MAX_SIZE];
+  pkt_t pkt;
+  uint64_t t0;
+
+  pkt.len = sizeof(pkt) - 1;
+  pkt.hdr.dev_id = 0x11223344;
+  pkt.hdr.pkt_id = 0x5566;
+  pkt.hdr.ack_id = 0x7788;
+  for (size_t i = 0; i < sizeof(pkt.data); i++)
+    pkt.data[i] = rand();
+
+  t0 = now_ns();
+  for (int r = 0; r < N_ROUNDS; r++) {
+    if (packet2string((char *)frame, sizeof(frame), &pkt, r) < 0)
+      abort();
+  }
+  bench_report("packet2string (max size)", N_ROUNDS, (uint64_t)N_ROUNDS * pkt.len, now_ns() - t0);
+
+  t0 = now_ns();
+  for (int r = 0; r < N_ROUNDS; r++) {
+    if (packet2frame(frame, sizeof(frame), &pkt, r) < 0)
+      abort();
+  }
+  bench_report("packet2frame (max size)", N_ROUNDS, (uint64_t)N_ROUNDS * pkt.len, now_ns() - t0);
+}
+
+int main(void) {
+  srand(1);
+  bench_base64();
+  bench_cobs();
+  bench_framing();
+  return 0;
+}
@@ -0,0 +1,66 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "base64.h"
+#include "downlink.h"
+#include "stats.h"
+#include "test.h"
+
+#define N_FRAMES 20000
+/* Size of the transfers from the CDC ACM FIFO */
+#define CHUNK_SIZE 64
+
+/* Encodes a packet frame with options like the host. Returns the size of the frame. */
+static size_t encode_packet(char *dst, const uint8_t *data, size_t len) {
+  downlink_opts_t opts = {.ttl_s = 60, .flags = 0};
+  uint32_t dev_id = 0x11223344;
+  uint16_t pkt_id = 0x5566;
+  size_t n = 0;
+
+  dst[n++] = '[';
+  n += base64_encode(dst + n, 16, (uint8_t *)&dev_id, sizeof(dev_id)) + 1;
+  n += base64_encode(dst + n, 16, (uint8_t *)&pkt_id, sizeof(pkt_id)) + 1;
+  n += base64_encode(dst + n, 512, (uint8_t *)data, len) + 1;
+  n += base64_encode(dst + n, 16, (uint8_t *)&opts, sizeof(opts)) + 1;
+  dst[n++] = ']';
+  return n;
+}
+
+/* Times decoding a stream of frames with the payload size in chunks like they arrive from the host */
+static void bench_receive(size_t data_len) {
+  static char stream[N_FRAMES * 400];
+  downlink_frame_t *frame;
+  uint8_t data[PKT_PAYLOAD_SIZE];
+  size_t len = 0;
+  int n_frames = 0;
+  uint64_t t0, t;
+  char name[64];
+
+  for (size_t i = 0; i < data_len; i++)
+    data[i] = rand();
+  for (int i = 0; i < N_FRAMES; i++)
+    len += encode_packet(stream + len, data, data_len);
+
+  t0 = now_ns();
+  for (size_t pos = 0; pos < len; pos += CHUNK_SIZE) {
+    downlink_receive((const uint8_t *)stream + pos, (pos + CHUNK_SIZE <= len) ? CHUNK_SIZE : len - pos);
+    while (downlink_get(&frame, K_NO_WAIT) == 0) {
+      n_frames++;
+      downlink_free(frame);
+    }
+  }
+  t = now_ns() - t0;
+
+  if (n_frames != N_FRAMES)
+    abort();
+  snprintf(name, sizeof(name), "downlink_receive (%zu B payload)", data_len);
+  bench_report(name, N_FRAMES, len, t);
+}
+
+int main(void) {
+  srand(1);
+  bench_receive(0);
+  bench_receive(32);
+  bench_receive(PKT_PAYLOAD_SIZE);
+  return 0;
+}
@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+
+#include "message_buffer.h"
+#include "message_buffer_priv.h"
+#include "test.h"
+
+#define N_ROUNDS 200
+/* Claims per device to average out the overhead of reading the clock */
+#define N_CLAIMS 100
+
+static pkt_t pkt;
+
+/* Times queueing one packet for each of n_devices devices, claiming and finishing it, in that order */
+static void bench_insert_claim_finish(unsigned int n_devices) {
+  uint64_t t_insert = 0, t_claim = 0, t_finish = 0, t0;
+  pkt_t *claimed;
+  char name[64];
+
+  for (int r = 0; r < N_ROUNDS; r++) {
+    t0 = now_ns();
+    for (uint32_t dev_id = 0; dev_id < n_devices; dev_id++) {
+      pkt.hdr.dev_id = dev_id;
+      if (msg_buf_insert(&pkt, 0, 0, NULL) != 0)
+        abort();
+    }
+    t_insert += now_ns() - t0;
+
+    t0 = now_ns();
+    for (uint32_t dev_id = 0; dev_id < n_devices; dev_id++) {
+      if (msg_buf_get_claim(&claimed, dev_id) != 0)
+        abort();
+    }
+    t_claim += now_ns() - t0;
+
+    t0 = now_ns();
+    for (uint32_t dev_id = 0; dev_id < n_devices; dev_id++) {
+      if (msg_buf_get_finish(dev_id) != 0)
+        abort();
+    }
+    t_finish += now_ns() - t0;
+  }
+
+  snprintf(name, sizeof(name), "msg_buf_insert (%u devices)", n_devices);
+  bench_report(name, (uint64_t)N_ROUNDS * n_devices, 0, t_insert);
+  snprintf(name, sizeof(name), "msg_buf_get_claim (%u devices)", n_devices);
+  bench_report(name, (uint64_t)N_ROUNDS * n_devices, 0, t_claim);
+  snprintf(name, sizeof(name), "msg_buf_get_finish (%u devices)", n_devices);
+  bench_report(name, (uint64_t)N_ROUNDS * n_devices, 0, t_finish);
+}
+
+/* Times the claim of each of the devices, which all hold as many packets as they may, and of a device without packets
+ * that has the same home slot in the index as the first device */
+static void bench_claim_worst_case(const char *ids_name, const uint32_t *dev_ids, unsigned int n_devices,
+                                   uint32_t absent_id) {
+  uint64_t t_sum = 0, t_max = 0, t_absent, t0, t;
+  pkt_t *claimed;
+  char name[64];
+
+  for (unsigned int i = 0; i < n_devices; i++) {
+    pkt.hdr.dev_id = dev_ids[i];
+    for (int k = 0; k < MAX_PKTS_PER_DEVICE; k++) {
+      if (msg_buf_insert(&pkt, 0, 0, NULL) != 0)
+        abort();
+    }
+  }
+
+  for (unsigned int i = 0; i < n_devices; i++) {
+    t0 = now_ns();
+    for (int k = 0; k < N_CLAIMS; k++) {
+      if (msg_buf_get_claim(&claimed, dev_ids[i]) != 0)
+        abort();
+    }
+    t = now_ns() - t0;
+    t_sum += t;
+    if (t > t_max)
+      t_max = t;
+  }
+
+  t0 = now_ns();
+  for (int k = 0; k < N_CLAIMS; k++) {
+    if (msg_buf_get_claim(&claimed, absent_id) != 1)
+      abort();
+  }
+  t_absent = now_ns() - t0;
+
+  snprintf(name, sizeof(name), "msg_buf_get_claim (%u %s devices)", n_devices, ids_name);
+  printf("%-44s mean %6.1f ns  max %6.1f ns  absent %6.1f ns\n", name, (double)t_sum / n_devices / N_CLAIMS,
+         (double)t_max / N_CLAIMS, (double)t_absent / N_CLAIMS);
+
+  for (unsigned int i = 0; i < n_devices; i++) {
+    for (int k = 0; k < MAX_PKTS_PER_DEVICE; k++) {
+      if (msg_buf_get_finish(dev_ids[i]) != 0)
+        abort();
+    }
+  }
+}
+
+/* Sweeps the number of devices at full occupancy with consecutive device IDs and with device IDs that all have the
+ * same home slot in the index, which is the worst case for the linear probing */
+static void bench_claim_sweep(void) {
+  static uint32_t sequential[MAX_NUM_DEVICES + 1], colliding[MAX_NUM_DEVICES + 1];
+  unsigned int n_colliding = 0;
+
+  for (uint32_t dev_id = 0; dev_id <= MAX_NUM_DEVICES; dev_id++)
+    sequential[dev_id] = dev_id;
+  for (uint32_t dev_id = 0; n_colliding <= MAX_NUM_DEVICES; dev_id++) {
+    if (dev_index_hash(dev_id) == dev_index_hash(0))
+      colliding[n_colliding++] = dev_id;
+  }
+
+  /* All devices together hold more packets than the pool */
+  shim_heap_unbounded = true;
+  for (unsigned int n_devices = 1; n_devices <= MAX_NUM_DEVICES; n_devices *= 2) {
+    bench_claim_worst_case("sequential", sequential, n_devices, sequential[MAX_NUM_DEVICES]);
+    bench_claim_worst_case("colliding", colliding, n_devices, colliding[MAX_NUM_DEVICES]);
+  }
+  shim_heap_unbounded = false;
+}
+
+int main(void) {
+  pkt.len = sizeof(pkt_header_t) + 32;
+  memset(pkt.data, 0x5A, 32);
+  msg_buf_init();
+
+  /* The shim backs k_heap with malloc(), so the insert and finish times include the host's allocator */
+  printf("Note: k_heap_alloc/k_heap_free measure the host C library's malloc/free (e.g. glibc), not the Zephyr "
+         "heap\n");
+  for (unsigned int n_devices = 1; n_devices <= MAX_NUM_DEVICES; n_devices *= 4)
+    bench_insert_claim_finish(n_devices);
+  bench_claim_sweep();
+  return 0;
+}
@@ -0,0 +1,98 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/crc.h>
+
+int64_t shim_uptime_ms;
+bool shim_heap_unbounded;
+
+/* Allocations are prefixed with their size, so that k_heap_free() can account for them */
+typedef struct {
+  size_t size;
+  max_align_t data[];
+} heap_block_t;
+
+void *k_heap_alloc(struct k_heap *h, size_t bytes, k_timeout_t timeout) {
+  size_t size = sizeof(heap_block_t) + bytes;
+  heap_block_t *block;
+
+  if (!shim_heap_unbounded && (h->used + size > h->size))
+    return NULL;
+  if ((block = malloc(size)) == NULL)
+    return NULL;
+
+  block->size = size;
+  h->used += size;
+  return block->data;
+}
+
+void k_heap_free(struct k_heap *h, void *mem) {
+  heap_block_t *block;
+
+  if (mem == NULL)
+    return;
+
+  block = CONTAINER_OF(mem, heap_block_t, data);
+  h->used -= block->size;
+  free(block);
+}
+
+int k_mem_slab_alloc(struct k_mem_slab *slab, void **mem, k_timeout_t timeout) {
+  if (slab->free_list != NULL) {
+    *mem = slab->free_list;
+    slab->free_list = *(void **)slab->free_list;
+  } else if (slab->num_touched < slab->num_blocks) {
+    *mem = slab->buffer + slab->num_touched++ * slab->block_size;
+  } else {
+    *mem = NULL;
+    return -ENOMEM;
+  }
+  slab->num_used++;
+  return 0;
+}
+
+void k_mem_slab_free(struct k_mem_slab *slab, void *mem) {
+  *(void **)mem = slab->free_list;
+  slab->free_list = mem;
+  slab->num_used--;
+}
+
+int k_msgq_put(struct k_msgq *msgq, const void *data, k_timeout_t timeout) {
+  if (msgq->used_msgs == msgq->max_msgs)
+    return -ENOMSG;
+  memcpy(msgq->buffer + (msgq->read_idx + msgq->used_msgs) % msgq->max_msgs * msgq->msg_size, data, msgq->msg_size);
+  msgq->used_msgs++;
+  return 0;
+}
+
+int k_msgq_get(struct k_msgq *msgq, void *data, k_timeout_t timeout) {
+  if (msgq->used_msgs == 0)
+    return -ENOMSG;
+  memcpy(data, msgq->buffer + msgq->read_idx * msgq->msg_size, msgq->msg_size);
+  msgq->read_idx = (msgq->read_idx + 1) % msgq->max_msgs;
+  msgq->used_msgs--;
+  return 0;
+}
+
+/* Same algorithm as Zephyr, so that the benchmarks of the framing are representative */
+uint16_t crc16_itu_t(uint16_t seed, const uint8_t *src, size_t len) {
+  for (; len > 0; len--) {
+    seed = (seed >> 8U) | (seed << 8U);
+    seed ^= *src++;
+    seed ^= (seed & 0xffU) >> 4U;
+    seed ^= seed << 12U;
+    seed ^= (seed & 0xffU) << 5U;
+  }
+  return seed;
+}
+
+void shim_log(const char *fmt, ...) {
+  va_list args;
+
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+}
@@ -0,0 +1,4 @@
+#ifndef __SHIM_DEVICE_H_
+#define __SHIM_DEVICE_H_
+
+#endif /* __SHIM_DEVICE_H_ */
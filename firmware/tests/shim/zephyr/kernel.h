@@ -0,0 +1,94 @@
+#ifndef __SHIM_KERNEL_H_
+#define __SHIM_KERNEL_H_
+
+/* Minimal host implementation of the Zephyr kernel API used by the pure-C firmware modules. Everything runs in a single
+ * thread, so locks do nothing and nothing ever waits. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BUILD_ASSERT(cond, msg) _Static_assert(cond, msg)
+#define CONTAINER_OF(ptr, type, field) ((type *)(((char *)(ptr)) - offsetof(type, field)))
+
+typedef struct {
+  /* Milliseconds, negative for K_FOREVER */
+  int64_t ms;
+} k_timeout_t;
+
+#define K_NO_WAIT ((k_timeout_t){0})
+#define K_FOREVER ((k_timeout_t){-1})
+#define K_MSEC(ms) ((k_timeout_t){(ms)})
+#define K_SECONDS(s) K_MSEC((s)*1000)
+
+/* Uptime returned by k_uptime_get(). Tests advance it to expire packets. */
+extern int64_t shim_uptime_ms;
+
+static inline int64_t k_uptime_get(void) {
+  return shim_uptime_ms;
+}
+
+struct k_spinlock {
+  int unused;
+};
+typedef int k_spinlock_key_t;
+
+static inline k_spinlock_key_t k_spin_lock(struct k_spinlock *lock) {
+  return 0;
+}
+
+static inline void k_spin_unlock(struct k_spinlock *lock, k_spinlock_key_t key) {}
+
+struct k_heap {
+  size_t size;
+  /* Bytes allocated, including the size header of every allocation */
+  size_t used;
+};
+
+#define K_HEAP_DEFINE(name, bytes) struct k_heap name = {.size = (bytes)}
+
+/* Lets allocations exceed the size of heaps, e.g. to benchmark queues that are fuller than the pool allows */
+extern bool shim_heap_unbounded;
+
+void *k_heap_alloc(struct k_heap *h, size_t bytes, k_timeout_t timeout);
+void k_heap_free(struct k_heap *h, void *mem);
+
+struct k_mem_slab {
+  char *buffer;
+  size_t block_size;
+  uint32_t num_blocks;
+  /* Blocks that were never allocated follow the free list */
+  uint32_t num_touched;
+  void *free_list;
+  uint32_t num_used;
+};
+
+#define K_MEM_SLAB_DEFINE_STATIC(name, slab_block_size, slab_num_blocks, slab_align)                              \
+  static char __attribute__((aligned(slab_align))) _k_mem_slab_buf_##name[(slab_num_blocks) * (slab_block_size)]; \
+  static struct k_mem_slab name = {                                                                               \
+      .buffer = _k_mem_slab_buf_##name, .block_size = (slab_block_size), .num_blocks = (slab_num_blocks)}
+
+int k_mem_slab_alloc(struct k_mem_slab *slab, void **mem, k_timeout_t timeout);
+void k_mem_slab_free(struct k_mem_slab *slab, void *mem);
+
+static inline uint32_t k_mem_slab_num_used_get(struct k_mem_slab *slab) {
+  return slab->num_used;
+}
+
+struct k_msgq {
+  char *buffer;
+  size_t msg_size;
+  uint32_t max_msgs;
+  uint32_t read_idx;
+  uint32_t used_msgs;
+};
+
+#define K_MSGQ_DEFINE(name, q_msg_size, q_max_msgs, q_align)                                     \
+  static char __attribute__((aligned(q_align))) _k_msgq_buf_##name[(q_max_msgs) * (q_msg_size)]; \
+  struct k_msgq name = {.buffer = _k_msgq_buf_##name, .msg_size = (q_msg_size), .max_msgs = (q_max_msgs)}
+
+int k_msgq_put(struct k_msgq *msgq, const void *data, k_timeout_t timeout);
+int k_msgq_get(struct k_msgq *msgq, void *data, k_timeout_t timeout);
+
+#endif /* __SHIM_KERNEL_H_ */
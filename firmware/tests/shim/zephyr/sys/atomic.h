@@ -0,0 +1,21 @@
+#ifndef __SHIM_ATOMIC_H_
+#define __SHIM_ATOMIC_H_
+
+typedef long atomic_t;
+typedef long atomic_val_t;
+
+static inline atomic_val_t atomic_inc(atomic_t *target) {
+  return (*target)++;
+}
+
+static inline atomic_val_t atomic_add(atomic_t *target, atomic_val_t value) {
+  atomic_val_t old = *target;
+  *target += value;
+  return old;
+}
+
+static inline atomic_val_t atomic_get(const atomic_t *target) {
+  return *target;
+}
+
+#endif /* __SHIM_ATOMIC_H_ */
@@ -0,0 +1,10 @@
+#ifndef __SHIM_CRC_H_
+#define __SHIM_CRC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC-16/CCITT with polynomial 0x1021, MSB first */
+uint16_t crc16_itu_t(uint16_t seed, const uint8_t *src, size_t len);
+
+#endif /* __SHIM_CRC_H_ */
@@ -0,0 +1,86 @@
+#ifndef __SHIM_SLIST_H_
+#define __SHIM_SLIST_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct _snode {
+  struct _snode *next;
+} sys_snode_t;
+
+typedef struct {
+  sys_snode_t *head;
+  sys_snode_t *tail;
+} sys_slist_t;
+
+static inline void sys_slist_init(sys_slist_t *list) {
+  list->head = NULL;
+  list->tail = NULL;
+}
+
+static inline bool sys_slist_is_empty(sys_slist_t *list) {
+  return list->head == NULL;
+}
+
+static inline sys_snode_t *sys_slist_peek_head(sys_slist_t *list) {
+  return list->head;
+}
+
+static inline sys_snode_t *sys_slist_peek_next(sys_snode_t *node) {
+  return node != NULL ? node->next : NULL;
+}
+
+static inline void sys_slist_prepend(sys_slist_t *list, sys_snode_t *node) {
+  node->next = list->head;
+  list->head = node;
+  if (list->tail == NULL)
+    list->tail = node;
+}
+
+static inline void sys_slist_append(sys_slist_t *list, sys_snode_t *node) {
+  node->next = NULL;
+  if (list->tail == NULL)
+    list->head = node;
+  else
+    list->tail->next = node;
+  list->tail = node;
+}
+
+/* Inserts node after prev */
+static inline void sys_slist_insert(sys_slist_t *list, sys_snode_t *prev, sys_snode_t *node) {
+  if (prev == NULL) {
+    sys_slist_prepend(list, node);
+  } else if (prev->next == NULL) {
+    sys_slist_append(list, node);
+  } else {
+    node->next = prev->next;
+    prev->next = node;
+  }
+}
+
+static inline sys_snode_t *sys_slist_get(sys_slist_t *list) {
+  sys_snode_t *node = list->head;
+
+  if (node != NULL) {
+    list->head = node->next;
+    if (list->tail == node)
+      list->tail = NULL;
+  }
+  return node;
+}
+
+/* Removes node, which follows prev_node or is the head if prev_node is NULL */
+static inline void sys_slist_remove(sys_slist_t *list, sys_snode_t *prev_node, sys_snode_t *node) {
+  if (prev_node == NULL) {
+    list->head = node->next;
+    if (list->tail == node)
+      list->tail = NULL;
+  } else {
+    prev_node->next = node->next;
+    if (list->tail == node)
+      list->tail = prev_node;
+  }
+  node->next = NULL;
+}
+
+#endif /* __SHIM_SLIST_H_ */
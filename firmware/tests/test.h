@@ -0,0 +1,50 @@
+#ifndef __TEST_H_
+#define __TEST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+static unsigned int n_failed;
+
+/* Reports a failed check and carries on, so that one run shows all failures */
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      n_failed++;                                                              \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_EQ(a, b)                                                                                       \
+  do {                                                                                                       \
+    long long _a = (a), _b = (b);                                                                            \
+    if (_a != _b) {                                                                                          \
+      fprintf(stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+      n_failed++;                                                                                            \
+    }                                                                                                        \
+  } while (0)
+
+/* Exit status of the test program */
+static inline int test_result(void) {
+  if (n_failed > 0)
+    fprintf(stderr, "%u checks failed\n", n_failed);
+  return n_failed > 0;
+}
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Prints the time per operation and, if bytes is not 0, the throughput of a benchmark */
+static inline void bench_report(const char *name, uint64_t n_ops, uint64_t bytes, uint64_t elapsed_ns) {
+  printf("%-40s %10.1f ns/op", name, (double)elapsed_ns / n_ops);
+  if (bytes > 0)
+    printf(" %10.1f MB/s", bytes * 1e3 / elapsed_ns);
+  printf("\n");
+}
+
+#endif /* __TEST_H_ */
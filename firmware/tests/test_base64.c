@@ -0,0 +1,150 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "base64.h"
+#include "test.h"
+
+/* Test vectors of RFC 4648 and inputs that use the URL-safe characters */
+static const struct {
+  const char *plain;
+  const char *encoded;
+} vectors[] = {
+    {"", ""},
+    {"f", "Zg=="},
+    {"fo", "Zm8="},
+    {"foo", "Zm9v"},
+    {"foob", "Zm9vYg=="},
+    {"fooba", "Zm9vYmE="},
+    {"foobar", "Zm9vYmFy"},
+    {"\xfb\xff", "-_8="},
+    {"\xfb\xef\xbe", "----"},
+    {"\xff\xff\xff", "____"},
+};
+
+/* Decodes the input character by character like the downlink */
+static int stream_decode(uint8_t *dst, size_t dst_size, const char *input, size_t length) {
+  base64_stream_t s;
+
+  base64_stream_init(&s, dst, dst_size);
+  for (size_t i = 0; i < length; i++) {
+    if (base64_stream_put(&s, input[i]) < 0)
+      return -1;
+  }
+  return base64_stream_finish(&s);
+}
+
+static void test_vectors(void) {
+  char encoded[16];
+  uint8_t decoded[16];
+
+  for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+    size_t plain_len = strlen(vectors[i].plain);
+    size_t encoded_len = strlen(vectors[i].encoded);
+
+    CHECK_EQ(base64_encode(encoded, sizeof(encoded), (uint8_t *)vectors[i].plain, plain_len), encoded_len);
+    CHECK(strcmp(encoded, vectors[i].encoded) == 0);
+
+    CHECK_EQ(stream_decode(decoded, sizeof(decoded), vectors[i].encoded, encoded_len), plain_len);
+    CHECK(memcmp(decoded, vectors[i].plain, plain_len) == 0);
+  }
+}
+
+static void test_round_trip(void) {
+  uint8_t plain[300], decoded[300];
+  char encoded[401];
+  int n;
+
+  srand(1);
+  for (size_t length = 0; length <= sizeof(plain); length++) {
+    for (size_t i = 0; i < length; i++)
+      plain[i] = rand();
+
+    n = base64_encode(encoded, sizeof(encoded), plain, length);
+    CHECK_EQ(n, (length + 2) / 3 * 4);
+    CHECK_EQ(strlen(encoded), n);
+
+    CHECK_EQ(stream_decode(decoded, length, encoded, n), length);
+    CHECK(memcmp(decoded, plain, length) == 0);
+  }
+}
+
+static void test_buffer_sizes(void) {
+  uint8_t plain[6] = "foobar";
+  uint8_t decoded[6];
+  char encoded[9];
+
+  /* The encoder also writes a terminating \0 */
+  CHECK_EQ(base64_encode(encoded, 8, plain, 6), -1);
+  CHECK_EQ(base64_encode(encoded, 9, plain, 6), 8);
+
+  CHECK_EQ(stream_decode(decoded, 5, "Zm9vYmFy", 8), -1);
+  CHECK_EQ(stream_decode(decoded, 4, "Zm9vYg==", 8), 4);
+}
+
+/* Checks that the decoder rejects the input */
+static void check_invalid(const char *input, size_t length) {
+  uint8_t decoded[16];
+
+  CHECK_EQ(stream_decode(decoded, sizeof(decoded), input, length), -1);
+}
+
+static void test_invalid_characters(void) {
+  char input[9] = "Zm9vYmFy";
+
+  for (int c = 0; c < 256; c++) {
+    if (strchr("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_=", c) != NULL && c != '\0')
+      continue;
+    for (size_t i = 0; i < 8; i++) {
+      input[i] = c;
+      check_invalid(input, 8);
+      input[i] = "Zm9vYmFy"[i];
+    }
+  }
+
+  /* Characters of the standard alphabet that the URL-safe alphabet replaces */
+  check_invalid("Zm9+", 4);
+  check_invalid("Zm9/", 4);
+}
+
+static void test_padding(void) {
+  static const char *invalid[] = {
+      /* Padding of more than two characters */
+      "Z===", "====", "Zm9v====",
+      /* Padding in front of other characters */
+      "=Zm9", "Zm=v", "Z=9v", "Zg==Zm9v", "Zm8=Zm9v",
+      /* Padding that does not complete a block */
+      "Zg=", "Zm9vYg=",
+  };
+
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    check_invalid(invalid[i], strlen(invalid[i]));
+}
+
+static void test_truncated(void) {
+  uint8_t plain[32], decoded[32];
+  char encoded[64];
+  int n;
+
+  for (size_t i = 0; i < sizeof(plain); i++)
+    plain[i] = rand();
+
+  for (size_t length = 1; length <= sizeof(plain); length++) {
+    n = base64_encode(encoded, sizeof(encoded), plain, length);
+    /* Every input that ends within a block is rejected */
+    for (int k = 1; k < n; k++) {
+      if (k % 4 != 0)
+        check_invalid(encoded, k);
+    }
+    CHECK_EQ(stream_decode(decoded, sizeof(decoded), encoded, n), length);
+  }
+}
+
+int main(void) {
+  test_vectors();
+  test_round_trip();
+  test_buffer_sizes();
+  test_invalid_characters();
+  test_padding();
+  test_truncated();
+  return test_result();
+}
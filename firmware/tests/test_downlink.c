@@ -0,0 +1,327 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "base64.h"
+#include "downlink.h"
+#include "message_buffer.h"
+#include "stats.h"
+#include "test.h"
+
+#define N_FUZZ_FRAMES 20000
+
+/* Encodes a packet frame like the host. Returns the size of the frame. */
+static size_t encode_packet(char *dst, uint32_t dev_id, uint16_t pkt_id, const uint8_t *data, size_t len,
+                            const downlink_opts_t *opts) {
+  size_t n = 0;
+
+  dst[n++] = '[';
+  n += base64_encode(dst + n, 16, (uint8_t *)&dev_id, sizeof(dev_id)) + 1;
+  n += base64_encode(dst + n, 16, (uint8_t *)&pkt_id, sizeof(pkt_id)) + 1;
+  n += base64_encode(dst + n, 512, (uint8_t *)data, len) + 1;
+  if (opts != NULL)
+    n += base64_encode(dst + n, 16, (uint8_t *)opts, sizeof(*opts)) + 1;
+  dst[n++] = ']';
+  return n;
+}
+
+/* Feeds the string including its \0 terminators, which sizeof counts */
+#define RECEIVE(str) downlink_receive((const uint8_t *)(str), sizeof(str) - 1)
+
+/* Shortest command frame */
+#define SHORT_CMD "{Aw==\0}"
+
+/* Gets the next frame, which must be a command. Returns the command or -1. */
+static int get_command(uint8_t *arg, uint8_t *arg_len) {
+  downlink_frame_t *frame;
+  int cmd;
+
+  if (downlink_get(&frame, K_NO_WAIT) != 0)
+    return -1;
+  cmd = (frame->type == DOWNLINK_COMMAND) ? frame->command.cmd : -1;
+  if (arg != NULL)
+    memcpy(arg, frame->command.arg, frame->command.arg_len);
+  if (arg_len != NULL)
+    *arg_len = frame->command.arg_len;
+  downlink_free(frame);
+  return cmd;
+}
+
+static void test_commands(void) {
+  uint8_t arg[DOWNLINK_CMD_ARG_SIZE], arg_len;
+  long errors = stats[STATS_DOWNLINK_FRAME_ERRORS];
+
+  CHECK_EQ(sizeof(SHORT_CMD) - 1, DOWNLINK_COMMAND_MIN_SIZE);
+
+  /* Without and with argument */
+  RECEIVE(SHORT_CMD "{AQ==\0AQ==\0}");
+  CHECK_EQ(get_command(NULL, &arg_len), 3);
+  CHECK_EQ(arg_len, 0);
+  CHECK_EQ(get_command(arg, &arg_len), 1);
+  CHECK(arg_len == 1 && arg[0] == 1);
+
+  /* Split at every byte */
+  const char cmd[] = "{Aw==\0AQIDBA==\0}";
+  for (size_t i = 0; i < sizeof(cmd) - 1; i++)
+    downlink_receive((const uint8_t *)cmd + i, 1);
+  CHECK_EQ(get_command(arg, &arg_len), 3);
+  CHECK(arg_len == 4 && memcmp(arg, "\1\2\3\4", 4) == 0);
+  CHECK_EQ(stats[STATS_DOWNLINK_FRAME_ERRORS], errors);
+
+  /* Malformed commands are dropped */
+  RECEIVE("{}");                                         /* Missing command */
+  RECEIVE("{Aw==}");                                     /* Unterminated field */
+  RECEIVE("{Aw==\0AQ==}");                               /* Unterminated argument */
+  RECEIVE("{AwA=\0}");                                   /* Command of two bytes */
+  RECEIVE("{Aw==\0AQ==\0AQ==\0}");                       /* Too many fields */
+  RECEIVE("{Aw==\0AAAAAAAAAAAAAAAAAAAAAAAA\0}");         /* Argument of 18 bytes */
+  RECEIVE("{Aw==\0]");                                   /* Closed like a packet */
+  RECEIVE("{A*==\0}");                                   /* Invalid character */
+  RECEIVE("{Aw==\0{AQ==\0}");                            /* Not closed before the next frame */
+  CHECK_EQ(get_command(NULL, NULL), 1);
+  CHECK_EQ(get_command(NULL, NULL), -1);
+  CHECK_EQ(stats[STATS_DOWNLINK_FRAME_ERRORS], errors + 9);
+}
+
+static void test_packets(void) {
+  static char stream[512];
+  uint8_t data[PKT_PAYLOAD_SIZE + 1];
+  downlink_opts_t opts = {.ttl_s = 1234, .flags = MSG_FLAG_PRIORITY};
+  downlink_frame_t *frame;
+  long errors = stats[STATS_DOWNLINK_FRAME_ERRORS];
+  size_t n;
+
+  for (size_t i = 0; i < sizeof(data); i++)
+    data[i] = i;
+
+  for (size_t len = 0; len <= PKT_PAYLOAD_SIZE; len++) {
+    n = encode_packet(stream, 0xDEADBEEF, len, data, len, (len % 2) ? &opts : NULL);
+    CHECK(n >= DOWNLINK_PACKET_MIN_SIZE && n <= DOWNLINK_FRAME_MAX_SIZE);
+    downlink_receive((const uint8_t *)stream, n);
+
+    CHECK_EQ(downlink_get(&frame, K_NO_WAIT), 0);
+    CHECK_EQ(frame->type, DOWNLINK_PACKET);
+    CHECK_EQ(frame->n_bytes, n);
+    CHECK_EQ(frame->packet.pkt.len, sizeof(pkt_header_t) + len);
+    CHECK_EQ(frame->packet.pkt.hdr.dev_id, 0xDEADBEEF);
+    CHECK_EQ(frame->packet.pkt.hdr.pkt_id, len);
+    CHECK(memcmp(frame->packet.pkt.data, data, len) == 0);
+    CHECK_EQ(frame->packet.opts.ttl_s, (len % 2) ? opts.ttl_s : 0);
+    CHECK_EQ(frame->packet.opts.flags, (len % 2) ? opts.flags : 0);
+    downlink_free(frame);
+  }
+
+  /* The longest frame has the largest payload and options */
+  CHECK_EQ(encode_packet(stream, 1, 1, data, PKT_PAYLOAD_SIZE, &opts), DOWNLINK_FRAME_MAX_SIZE);
+
+  /* Oversized payload */
+  n = encode_packet(stream, 1, 1, data, PKT_PAYLOAD_SIZE + 1, NULL);
+  downlink_receive((const uint8_t *)stream, n);
+  CHECK_EQ(downlink_get(&frame, K_NO_WAIT), -ENOMSG);
+  CHECK_EQ(stats[STATS_DOWNLINK_FRAME_ERRORS], errors + 1);
+}
+
+/* Frames that arrive while their pool is exhausted are dropped and do not take up a slot later. The pools of packets
+ * and commands are exhausted independently. */
+static void test_pool_exhausted(void) {
+  char stream[DOWNLINK_FRAME_MAX_SIZE];
+  downlink_frame_t *frame;
+  long dropped = stats[STATS_DOWNLINK_DROPPED];
+  int n_frames[2] = {0, 0};
+  size_t n;
+
+  n = encode_packet(stream, 1, 1, NULL, 0, NULL);
+  CHECK_EQ(n, DOWNLINK_PACKET_MIN_SIZE);
+  for (int i = 0; i < DOWNLINK_PACKET_POOL_SIZE + 5; i++)
+    downlink_receive((const uint8_t *)stream, n);
+  for (int i = 0; i < DOWNLINK_COMMAND_POOL_SIZE + 5; i++)
+    RECEIVE(SHORT_CMD);
+  while (downlink_get(&frame, K_NO_WAIT) == 0) {
+    n_frames[frame->type]++;
+    downlink_free(frame);
+  }
+  CHECK_EQ(n_frames[DOWNLINK_PACKET], DOWNLINK_PACKET_POOL_SIZE);
+  CHECK_EQ(n_frames[DOWNLINK_COMMAND], DOWNLINK_COMMAND_POOL_SIZE);
+  CHECK_EQ(stats[STATS_DOWNLINK_DROPPED], dropped + 10);
+
+  RECEIVE(SHORT_CMD);
+  CHECK_EQ(get_command(NULL, NULL), 3);
+}
+
+/* A host that never sends more than the window beyond the consumed data does not exhaust the pools, even if the
+ * application only takes one frame at a time and holds on to it while the host fills up the window again */
+static void test_window(void) {
+  static char stream[3000 * DOWNLINK_FRAME_MAX_SIZE];
+  uint8_t data[PKT_PAYLOAD_SIZE];
+  downlink_frame_t *held = NULL;
+  long dropped = stats[STATS_DOWNLINK_DROPPED], errors = stats[STATS_DOWNLINK_FRAME_ERRORS];
+  uint32_t consumed_start = downlink_consumed();
+  size_t len = 0, sent = 0, consumed = 0, n;
+  int n_frames = 0;
+
+  memset(data, 0x5A, sizeof(data));
+  /* The shortest frames take up the most slots, followed by frames of random size */
+  for (int i = 0; i < 1000; i++) {
+    memcpy(stream + len, SHORT_CMD, DOWNLINK_COMMAND_MIN_SIZE);
+    len += DOWNLINK_COMMAND_MIN_SIZE;
+  }
+  for (int i = 1000; i < 3000; i++)
+    len += encode_packet(stream + len, 1, i, data, (i < 2000) ? 0 : rand() % (PKT_PAYLOAD_SIZE + 1), NULL);
+
+  while (consumed < len) {
+    n = consumed + DOWNLINK_WINDOW - sent;
+    if (sent + n > len)
+      n = len - sent;
+    downlink_receive((const uint8_t *)stream + sent, n);
+    sent += n;
+
+    if (held != NULL) {
+      downlink_free(held);
+      held = NULL;
+    }
+    /* Consumed when the application takes the frame like in main.c */
+    if (downlink_get(&held, K_NO_WAIT) != 0)
+      break;
+    CHECK_EQ(held->type, (n_frames < 1000) ? DOWNLINK_COMMAND : DOWNLINK_PACKET);
+    if (held->type == DOWNLINK_PACKET)
+      CHECK_EQ(held->packet.pkt.hdr.pkt_id, n_frames);
+    consumed = downlink_consumed() - consumed_start;
+    n_frames++;
+  }
+  if (held != NULL)
+    downlink_free(held);
+
+  CHECK_EQ(n_frames, 3000);
+  CHECK_EQ(stats[STATS_DOWNLINK_DROPPED], dropped);
+  CHECK_EQ(stats[STATS_DOWNLINK_FRAME_ERRORS], errors);
+}
+
+/* A burst of bad frames and garbage gives the host all of its credits back without another frame following it */
+static void test_skipped_consumed(void) {
+  static char stream[64 * DOWNLINK_FRAME_MAX_SIZE];
+  uint8_t data[PKT_PAYLOAD_SIZE + 1];
+  downlink_frame_t *frame;
+  uint32_t consumed = downlink_consumed();
+  size_t len = 0, n;
+
+  memset(data, 0xA5, sizeof(data));
+  for (int i = 0; i < 64; i++) {
+    n = encode_packet(stream + len, 1, i, data, (i % 2) ? PKT_PAYLOAD_SIZE + 1 : i, NULL);
+    /* Every other frame is oversized, the others are corrupted, not terminated or closed like a command */
+    if (i % 6 == 0) {
+      stream[len + n / 2] = '*';
+    } else if (i % 6 == 2) {
+      n--;
+    } else if (i % 6 == 4) {
+      stream[len + n - 1] = '}';
+      stream[len + n++] = '#';
+    }
+    len += n;
+  }
+  /* The last frame is closed, so nothing is left in the decoder */
+  stream[len++] = ']';
+
+  downlink_receive((const uint8_t *)stream, len);
+  CHECK_EQ(downlink_get(&frame, K_NO_WAIT), -ENOMSG);
+  CHECK_EQ(downlink_consumed() - consumed, len);
+
+  /* The bytes of a frame are consumed once it is complete and the application takes it */
+  consumed = downlink_consumed();
+  RECEIVE("xx{Aw==");
+  CHECK_EQ(downlink_consumed() - consumed, 2);
+  RECEIVE("\0}");
+  CHECK_EQ(downlink_consumed() - consumed, 2);
+  CHECK_EQ(get_command(NULL, NULL), 3);
+  CHECK_EQ(downlink_consumed() - consumed, 2 + DOWNLINK_COMMAND_MIN_SIZE);
+}
+
+/* Device ID of the fuzzed frames. Since both IDs of a frame identify it, a corrupted frame that still decodes, e.g.
+ * because of non-zero padding bits, is not mistaken for another frame. */
+static uint32_t fuzz_dev_id(uint16_t pkt_id) {
+  return pkt_id * 2654435761U;
+}
+
+/* Valid frames interleaved with corrupted, truncated and oversized frames and garbage, fed in chunks of random size.
+ * Every valid frame must arrive intact and all data must be consumed. */
+static void test_fuzz(void) {
+  static char stream[N_FUZZ_FRAMES * 400];
+  static uint8_t ref[N_FUZZ_FRAMES][PKT_PAYLOAD_SIZE];
+  static uint16_t ref_len[N_FUZZ_FRAMES];
+  static bool valid[N_FUZZ_FRAMES];
+  static unsigned int n_received[N_FUZZ_FRAMES];
+  downlink_frame_t *frame;
+  uint8_t data[PKT_PAYLOAD_SIZE + 32];
+  uint32_t consumed = downlink_consumed();
+  size_t len = 0, pos = 0, n;
+  long mismatched = 0;
+
+  srand(1);
+  for (int i = 0; i < N_FUZZ_FRAMES; i++) {
+    size_t data_len = rand() % (PKT_PAYLOAD_SIZE + 1);
+    bool corrupted = rand() % 20 == 0, truncated = rand() % 30 == 0, oversized = rand() % 50 == 0;
+    downlink_opts_t opts = {.ttl_s = rand(), .flags = rand() % 4};
+
+    if (oversized)
+      data_len = PKT_PAYLOAD_SIZE + 1 + rand() % 31;
+    for (size_t j = 0; j < data_len; j++)
+      data[j] = rand();
+    n = encode_packet(stream + len, fuzz_dev_id(i), i, data, data_len, (rand() % 2) ? &opts : NULL);
+
+    if (corrupted) {
+      for (int c = 1 + rand() % 3; c > 0; c--)
+        stream[len + rand() % n] = rand();
+    }
+    if (truncated)
+      n = rand() % n;
+    len += n;
+
+    /* Garbage between frames */
+    if (rand() % 10 == 0) {
+      for (int c = rand() % 20; c > 0; c--)
+        stream[len++] = rand();
+    }
+
+    valid[i] = !corrupted && !truncated && !oversized;
+    memcpy(ref[i], data, valid[i] ? data_len : 0);
+    ref_len[i] = data_len;
+  }
+  /* Ends with a valid frame, so that nothing is left in the decoder */
+  stream[len++] = '{';
+  memcpy(stream + len, "Aw==\0}", 6);
+  len += 6;
+
+  while (pos < len) {
+    n = 1 + rand() % 64;
+    if (pos + n > len)
+      n = len - pos;
+    downlink_receive((const uint8_t *)stream + pos, n);
+    pos += n;
+
+    while (downlink_get(&frame, K_NO_WAIT) == 0) {
+      if (frame->type == DOWNLINK_PACKET) {
+        uint16_t pkt_id = frame->packet.pkt.hdr.pkt_id;
+        size_t data_len = frame->packet.pkt.len - sizeof(pkt_header_t);
+        if (pkt_id < N_FUZZ_FRAMES && valid[pkt_id] && frame->packet.pkt.hdr.dev_id == fuzz_dev_id(pkt_id)) {
+          n_received[pkt_id]++;
+          if (data_len != ref_len[pkt_id] || memcmp(frame->packet.pkt.data, ref[pkt_id], data_len) != 0)
+            mismatched++;
+        }
+      }
+      downlink_free(frame);
+    }
+  }
+
+  for (int i = 0; i < N_FUZZ_FRAMES; i++)
+    CHECK(!valid[i] || n_received[i] == 1);
+  CHECK_EQ(mismatched, 0);
+  CHECK_EQ(downlink_consumed() - consumed, len);
+}
+
+int main(void) {
+  test_commands();
+  test_packets();
+  test_pool_exhausted();
+  test_window();
+  test_skipped_consumed();
+  test_fuzz();
+  return test_result();
+}
@@ -0,0 +1,214 @@
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+
+#include "base64.h"
+#include "cobs.h"
+#include "framing.h"
+#include "test.h"
+
+/* Reverses cobs_encode() like the host. Returns the number of decoded bytes or -1 if the input is not valid COBS. */
+static int cobs_decode(uint8_t *output, size_t output_size, const uint8_t *input, size_t length) {
+  size_t i = 0, j = 0;
+  uint8_t code;
+
+  while (i < length) {
+    if ((code = input[i++]) == 0 || i + code - 1 > length)
+      return -1;
+    for (unsigned int k = 1; k < code; k++) {
+      if (input[i] == 0 || j == output_size)
+        return -1;
+      output[j++] = input[i++];
+    }
+    /* Blocks of maximum length and the last block have no implicit zero */
+    if (code < 0xFF && i < length) {
+      if (j == output_size)
+        return -1;
+      output[j++] = 0;
+    }
+  }
+  return j;
+}
+
+/* Decodes a binary frame including the delimiter and checks its trailer. Returns the length of the raw frame. */
+static int frame_decode(uint8_t *raw, size_t raw_size, const uint8_t *frame, size_t length) {
+  int n;
+
+  if (length == 0 || frame[length - 1] != 0 || memchr(frame, 0, length - 1) != NULL)
+    return -1;
+  if ((n = cobs_decode(raw, raw_size, frame, length - 1)) < FRAME_TRAILER_SIZE)
+    return -1;
+
+  n -= FRAME_TRAILER_SIZE;
+  if (sys_get_le16(raw + n) != n || sys_get_le16(raw + n + 2) != crc16_itu_t(0xFFFF, raw, n + 2))
+    return -1;
+  return n;
+}
+
+/* Splits the \0-terminated fields of a text frame and decodes them. Returns the number of fields or -1. */
+static int string_decode(uint8_t fields[][256], int field_len[], int max_fields, const char *frame, size_t length,
+                         char open, char close) {
+  base64_stream_t s;
+  int n_fields = 0;
+
+  if (length < 2 || frame[0] != open || frame[length - 1] != close)
+    return -1;
+
+  for (size_t i = 1; i < length - 1; i++) {
+    if (n_fields == max_fields)
+      return -1;
+    base64_stream_init(&s, fields[n_fields], 256);
+    for (; frame[i] != '\0'; i++) {
+      if (i == length - 1 || base64_stream_put(&s, frame[i]) < 0)
+        return -1;
+    }
+    if ((field_len[n_fields++] = base64_stream_finish(&s)) < 0)
+      return -1;
+  }
+  return n_fields;
+}
+
+static void random_pkt(pkt_t *pkt, size_t payload_len) {
+  pkt->len = sizeof(pkt_header_t) + payload_len;
+  pkt->hdr.dev_id = rand();
+  pkt->hdr.pkt_id = rand();
+  pkt->hdr.ack_id = rand();
+  for (size_t i = 0; i < payload_len; i++)
+    /* Plenty of zeros to exercise the byte stuffing */
+    pkt->data[i] = (rand() % 4 == 0) ? 0 : rand();
+}
+
+static void test_crc(void) {
+  /* Check value of CRC-16/CCITT-FALSE, which the host computes with binascii.crc_hqx() */
+  CHECK_EQ(crc16_itu_t(0xFFFF, (const uint8_t *)"123456789", 9), 0x29B1);
+}
+
+static void test_cobs(void) {
+  uint8_t input[1024], encoded[COBS_ENCODED_SIZE(1024)], decoded[1024];
+  int n;
+
+  /* Runs of zeros and of non-zero bytes around the maximum block length */
+  for (size_t length = 0; length <= 600; length++) {
+    for (int pattern = 0; pattern < 4; pattern++) {
+      for (size_t i = 0; i < length; i++) {
+        switch (pattern) {
+          case 0:
+            input[i] = 0;
+            break;
+          case 1:
+            input[i] = 1 + i % 255;
+            break;
+          case 2:
+            input[i] = (i % 300 == 299) ? 0 : 0xAA;
+            break;
+          default:
+            input[i] = (rand() % 8 == 0) ? 0 : rand();
+            break;
+        }
+      }
+
+      n = cobs_encode(encoded, sizeof(encoded), input, length);
+      CHECK(n > 0 && n <= COBS_ENCODED_SIZE(length));
+      CHECK(memchr(encoded, 0, n) == NULL);
+      CHECK_EQ(cobs_decode(decoded, sizeof(decoded), encoded, n), length);
+      CHECK(memcmp(decoded, input, length) == 0);
+    }
+  }
+
+  memset(input, 0xAA, 254);
+  CHECK_EQ(cobs_encode(encoded, COBS_ENCODED_SIZE(254) - 1, input, 254), -1);
+  CHECK_EQ(cobs_encode(encoded, COBS_ENCODED_SIZE(254), input, 254), 256);
+}
+
+static void test_packet2frame(void) {
+  uint8_t frame[PKT_FRAME_MAX_SIZE], raw[PKT_FRAME_MAX_SIZE];
+  pkt_t pkt;
+  int n, raw_len;
+
+  for (size_t payload_len = 0; payload_len <= PKT_PAYLOAD_SIZE; payload_len++) {
+    int64_t timestamp = ((int64_t)rand() << 31) | rand();
+
+    random_pkt(&pkt, payload_len);
+    n = packet2frame(frame, sizeof(frame), &pkt, timestamp);
+    CHECK(n > 0 && n <= PKT_FRAME_MAX_SIZE);
+
+    raw_len = frame_decode(raw, sizeof(raw), frame, n);
+    CHECK_EQ(raw_len, 1 + sizeof(int64_t) + pkt.len + 1);
+    if (raw_len < 0)
+      continue;
+    CHECK_EQ(raw[0], FRAME_TYPE_PACKET);
+    CHECK_EQ((int64_t)sys_get_le64(raw + 1), timestamp);
+    CHECK(memcmp(raw + 1 + sizeof(int64_t), &pkt, pkt.len + 1) == 0);
+  }
+}
+
+static void test_event2frame(void) {
+  uint8_t frame[PKT_FRAME_MAX_SIZE], raw[PKT_FRAME_MAX_SIZE];
+  uint8_t body[EVENT_BODY_MAX_SIZE + 1];
+  int n;
+
+  for (size_t len = 0; len <= EVENT_BODY_MAX_SIZE; len++) {
+    for (size_t i = 0; i < len; i++)
+      body[i] = rand();
+
+    n = event2frame(frame, sizeof(frame), FRAME_TYPE_STATS, body, len);
+    CHECK_EQ(frame_decode(raw, sizeof(raw), frame, n), 1 + len);
+    CHECK_EQ(raw[0], FRAME_TYPE_STATS);
+    CHECK(memcmp(raw + 1, body, len) == 0);
+  }
+
+  CHECK_EQ(event2frame(frame, sizeof(frame), FRAME_TYPE_STATS, body, EVENT_BODY_MAX_SIZE + 1), -1);
+}
+
+static void test_packet2string(void) {
+  char frame[PKT_FRAME_MAX_SIZE];
+  uint8_t fields[5][256];
+  int field_len[5];
+  pkt_t pkt;
+  int n;
+
+  for (size_t payload_len = 0; payload_len <= PKT_PAYLOAD_SIZE; payload_len++) {
+    int64_t timestamp = ((int64_t)rand() << 31) | rand();
+
+    random_pkt(&pkt, payload_len);
+    n = packet2string(frame, sizeof(frame), &pkt, timestamp);
+    CHECK(n > 0 && n <= PKT_FRAME_MAX_SIZE);
+
+    CHECK_EQ(string_decode(fields, field_len, 5, frame, n, '[', ']'), 5);
+    CHECK(field_len[0] == 4 && memcmp(fields[0], &pkt.hdr.dev_id, 4) == 0);
+    CHECK(field_len[1] == 2 && memcmp(fields[1], &pkt.hdr.pkt_id, 2) == 0);
+    CHECK(field_len[2] == 2 && memcmp(fields[2], &pkt.hdr.ack_id, 2) == 0);
+    CHECK(field_len[3] == 8 && memcmp(fields[3], &timestamp, 8) == 0);
+    CHECK(field_len[4] == payload_len && memcmp(fields[4], pkt.data, payload_len) == 0);
+  }
+}
+
+static void test_event2string(void) {
+  char frame[PKT_FRAME_MAX_SIZE];
+  uint8_t body[EVENT_BODY_MAX_SIZE];
+  uint8_t fields[2][256];
+  int field_len[2];
+  int n;
+
+  for (size_t len = 0; len <= EVENT_BODY_MAX_SIZE; len++) {
+    for (size_t i = 0; i < len; i++)
+      body[i] = rand();
+
+    n = event2string(frame, sizeof(frame), FRAME_TYPE_STATS, body, len);
+    CHECK_EQ(string_decode(fields, field_len, 2, frame, n, '{', '}'), 2);
+    CHECK(field_len[0] == 1 && fields[0][0] == FRAME_TYPE_STATS);
+    CHECK(field_len[1] == len && memcmp(fields[1], body, len) == 0);
+  }
+}
+
+int main(void) {
+  srand(1);
+  test_crc();
+  test_cobs();
+  test_packet2frame();
+  test_event2frame();
+  test_packet2string();
+  test_event2string();
+  return test_result();
+}
@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+
+#include "message_buffer.h"
+#include "message_buffer_priv.h"
+#include "test.h"
+
+/* Packets reported by the discard callback */
+static struct {
+  uint32_t dev_id;
+  uint16_t pkt_id;
+  uint8_t reason;
+} discarded[1024];
+static unsigned int n_discarded;
+
+static void on_discard(uint32_t dev_id, uint16_t pkt_id, uint8_t reason) {
+  discarded[n_discarded].dev_id = dev_id;
+  discarded[n_discarded].pkt_id = pkt_id;
+  discarded[n_discarded].reason = reason;
+  n_discarded++;
+}
+
+static int insert(uint32_t dev_id, uint16_t pkt_id, size_t payload_len, uint16_t ttl_s, uint8_t flags) {
+  pkt_t pkt;
+
+  pkt.len = sizeof(pkt_header_t) + payload_len;
+  pkt.hdr.dev_id = dev_id;
+  pkt.hdr.pkt_id = pkt_id;
+  pkt.hdr.ack_id = 0;
+  memset(pkt.data, pkt_id, payload_len);
+  return msg_buf_insert(&pkt, ttl_s, flags, on_discard);
+}
+
+/* Claims and finishes the next packet of the device. Returns its ID or -1 if there is none. */
+static int take(uint32_t dev_id) {
+  pkt_t *pkt;
+  int pkt_id;
+
+  if (msg_buf_get_claim(&pkt, dev_id) != 0)
+    return -1;
+  pkt_id = pkt->hdr.pkt_id;
+  CHECK_EQ(msg_buf_get_finish(dev_id), 0);
+  return pkt_id;
+}
+
+/* Discards all packets, so that every test starts with an empty pool */
+static void reset(void) {
+  shim_uptime_ms += 1000LL * 1000 * 1000;
+  msg_buf_sweep(NULL);
+  msg_buf_init();
+  n_discarded = 0;
+}
+
+static void test_fifo(void) {
+  pkt_t *pkt;
+
+  reset();
+  CHECK_EQ(msg_buf_get_claim(&pkt, 1), 1);
+  CHECK_EQ(msg_buf_get_finish(1), -1);
+
+  for (int i = 0; i < 10; i++) {
+    CHECK_EQ(insert(1, i, i * 20, 0, 0), 0);
+    CHECK_EQ(insert(2, 100 + i, 0, 0, 0), 0);
+  }
+
+  /* The claimed packet stays in place until it is finished */
+  CHECK_EQ(msg_buf_get_claim(&pkt, 1), 0);
+  CHECK_EQ(msg_buf_get_claim(&pkt, 1), 0);
+  CHECK_EQ(pkt->hdr.pkt_id, 0);
+
+  for (int i = 0; i < 10; i++) {
+    CHECK_EQ(msg_buf_get_claim(&pkt, 1), 0);
+    CHECK_EQ(pkt->len, sizeof(pkt_header_t) + i * 20);
+    CHECK_EQ(pkt->hdr.pkt_id, i);
+    CHECK(i == 0 || pkt->data[i * 20 - 1] == i);
+    CHECK_EQ(msg_buf_get_finish(1), 0);
+    CHECK_EQ(take(2), 100 + i);
+  }
+
+  /* Buffers of devices without packets are released */
+  CHECK_EQ(msg_buf_get_claim(&pkt, 1), 1);
+  CHECK_EQ(msg_buf_get_claim(&pkt, 2), 1);
+  CHECK_EQ(n_discarded, 0);
+}
+
+static void test_priority(void) {
+  pkt_t *pkt;
+
+  reset();
+  CHECK_EQ(insert(1, 1, 0, 0, 0), 0);
+  CHECK_EQ(insert(1, 2, 0, 0, MSG_FLAG_PRIORITY), 0);
+  CHECK_EQ(take(1), 2);
+
+  /* A priority packet does not overtake the claimed packet */
+  CHECK_EQ(insert(1, 3, 0, 0, 0), 0);
+  CHECK_EQ(msg_buf_get_claim(&pkt, 1), 0);
+  CHECK_EQ(insert(1, 4, 0, 0, MSG_FLAG_PRIORITY), 0);
+  CHECK_EQ(pkt->hdr.pkt_id, 1);
+  CHECK_EQ(msg_buf_get_finish(1), 0);
+
+  CHECK_EQ(take(1), 4);
+  CHECK_EQ(take(1), 3);
+  CHECK_EQ(take(1), -1);
+}
+
+static void test_replace(void) {
+  pkt_t *pkt;
+
+  reset();
+  CHECK_EQ(insert(1, 1, 0, 0, MSG_FLAG_REPLACE), 0);
+  CHECK_EQ(insert(1, 2, 0, 0, 0), 0);
+  CHECK_EQ(insert(1, 3, 0, 0, MSG_FLAG_REPLACE), 0);
+  CHECK_EQ(n_discarded, 1);
+  CHECK(discarded[0].dev_id == 1 && discarded[0].pkt_id == 1 && discarded[0].reason == MSG_DISCARD_REPLACED);
+
+  /* The claimed packet is not replaced, since the radio may be sending it */
+  CHECK_EQ(msg_buf_get_claim(&pkt, 1), 0);
+  CHECK_EQ(insert(1, 4, 0, 0, MSG_FLAG_REPLACE | MSG_FLAG_PRIORITY), 0);
+  CHECK_EQ(n_discarded, 2);
+  CHECK_EQ(discarded[1].pkt_id, 3);
+  CHECK_EQ(msg_buf_get_finish(1), 0);
+
+  CHECK_EQ(take(1), 4);
+  CHECK_EQ(take(1), -1);
+}
+
+static void test_expiry(void) {
+  reset();
+  CHECK_EQ(insert(1, 1, 0, 10, 0), 0);
+  CHECK_EQ(insert(1, 2, 0, 20, 0), 0);
+  CHECK_EQ(insert(2, 3, 0, 0, 0), 0);
+
+  shim_uptime_ms += 10 * 1000 - 1;
+  msg_buf_sweep(on_discard);
+  CHECK_EQ(n_discarded, 0);
+
+  shim_uptime_ms += 1;
+  msg_buf_sweep(on_discard);
+  CHECK_EQ(n_discarded, 1);
+  CHECK(discarded[0].pkt_id == 1 && discarded[0].reason == MSG_DISCARD_EXPIRED);
+
+  /* Packets without TTL live for the default TTL */
+  shim_uptime_ms += MSG_DEFAULT_TTL_S * 1000;
+  msg_buf_sweep(on_discard);
+  CHECK_EQ(n_discarded, 3);
+  CHECK_EQ(take(1), -1);
+  CHECK_EQ(take(2), -1);
+}
+
+static void test_limits(void) {
+  reset();
+  for (int i = 0; i < MAX_PKTS_PER_DEVICE; i++)
+    CHECK_EQ(insert(1, i, 0, 0, 0), 0);
+  CHECK_EQ(insert(1, MAX_PKTS_PER_DEVICE, 0, 0, 0), -ENOSPC);
+
+  reset();
+  for (uint32_t dev_id = 0; dev_id < MAX_NUM_DEVICES; dev_id++)
+    CHECK_EQ(insert(dev_id, 0, 0, 0, 0), 0);
+  CHECK_EQ(insert(MAX_NUM_DEVICES, 0, 0, 0, 0), -ENOSPC);
+  /* Releasing a buffer makes space for another device */
+  CHECK_EQ(take(0), 0);
+  CHECK_EQ(insert(MAX_NUM_DEVICES, 0, 0, 0, 0), 0);
+
+  /* Large packets exhaust the pool before the devices run out of buffers */
+  reset();
+  int err = 0;
+  for (uint32_t dev_id = 0; dev_id < MAX_NUM_DEVICES && err == 0; dev_id++) {
+    for (int i = 0; i < MAX_PKTS_PER_DEVICE / 2 && err == 0; i++)
+      err = insert(dev_id, i, PKT_PAYLOAD_SIZE, 0, 0);
+  }
+  CHECK_EQ(err, -ENOMEM);
+}
+
+/* Inserts and removes packets of random devices and compares the result with a simple model. The devices share a few
+ * home slots at the end of the index, so that deleting from the index has to shift probe sequences that wrap around. */
+static void test_random(void) {
+  static uint32_t dev_ids[12];
+  static int model[12][MAX_PKTS_PER_DEVICE];
+  unsigned int n_model[12] = {0};
+  unsigned int n_dev_ids = 0;
+  uint16_t pkt_id = 0;
+
+  for (uint32_t dev_id = 0; n_dev_ids < 12; dev_id++) {
+    if (dev_index_hash(dev_id) >= (1 << DEV_INDEX_BITS) - 2 || dev_index_hash(dev_id) == 0)
+      dev_ids[n_dev_ids++] = dev_id;
+  }
+
+  reset();
+  srand(1);
+  for (int i = 0; i < 100000; i++) {
+    unsigned int d = rand() % n_dev_ids;
+
+    if (rand() % 2 == 0 && n_model[d] < MAX_PKTS_PER_DEVICE) {
+      CHECK_EQ(insert(dev_ids[d], pkt_id, rand() % 32, 0, 0), 0);
+      model[d][n_model[d]++] = pkt_id++;
+    } else if (n_model[d] > 0) {
+      CHECK_EQ(take(dev_ids[d]), model[d][0]);
+      memmove(model[d], model[d] + 1, --n_model[d] * sizeof(model[d][0]));
+    } else {
+      CHECK_EQ(take(dev_ids[d]), -1);
+    }
+  }
+}
+
+int main(void) {
+  msg_buf_init();
+  test_fifo();
+  test_priority();
+  test_replace();
+  test_expiry();
+  test_limits();
+  test_random();
+  return test_result();
+}
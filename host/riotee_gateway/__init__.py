@@ -5,6 +5,7 @@ __version__ = "0.1.1"
 import base64
 import numpy as np
 
+from riotee_gateway.async_client import AsyncGatewayClient
 from riotee_gateway.client import GatewayClient
 from riotee_gateway.packet_model import PacketApiSend
 from riotee_gateway.transceiver import Transceiver
@@ -0,0 +1,133 @@
+import asyncio
+import httpx
+import io
+import numpy as np
+from typing import Iterable
+from typing import List
+from typing import Tuple
+
+from riotee_gateway.client import SEND_RETRIES
+from riotee_gateway.client import encode_data
+from riotee_gateway.client import to_dev_id_b64
+from riotee_gateway.packet_model import PacketApiReceive
+from riotee_gateway.packet_model import PacketApiSend
+
+
+class AsyncGatewayClient(object):
+    """Client for the API of the gateway server for asyncio applications.
+
+    Requests share a pool of up to max_connections connections to the server that are kept open between requests, so
+    that many requests can be in flight at the same time, e.g., when sending packets to many devices.
+    """
+
+    def __init__(self, host: str = "localhost", port: int = 8000, max_connections: int = 32):
+        limits = httpx.Limits(max_connections=max_connections, max_keepalive_connections=max_connections)
+        # Requests wait for a free connection in the pool for as long as it takes, so that any number of them can be
+        # started at once
+        timeout = httpx.Timeout(10.0, pool=None)
+        self.__client = httpx.AsyncClient(base_url=f"http://{host}:{port}", limits=limits, timeout=timeout)
+
+    async def __aenter__(self):
+        return self
+
+    async def __aexit__(self, *args):
+        await self.close()
+
+    async def close(self):
+        await self.__client.aclose()
+
+    async def get_devices(self) -> List[str]:
+        """Reads the list of all devices from which the gateway has received packets."""
+        r = await self.__client.get("/devices")
+        r.raise_for_status()
+        return r.json()
+
+    async def get_stats(self) -> dict:
+        """Reads the packet counters of the transceiver pipeline stages and the server."""
+        r = await self.__client.get("/stats")
+        r.raise_for_status()
+        return r.json()
+
+    async def send_packet(self, dev_id: int | str, pkt: PacketApiSend, wait: float = None) -> dict:
+        """Sends the packet to the device like GatewayClient.send_packet()."""
+        dev_id = to_dev_id_b64(dev_id)
+        for _ in range(SEND_RETRIES):
+            r = await self.__client.post(f"/out/{dev_id}", content=pkt.model_dump_json())
+            if r.status_code != 503:
+                break
+            await asyncio.sleep(float(r.headers.get("Retry-After", 1)))
+        r.raise_for_status()
+        if wait is not None:
+            return await self.get_delivery(dev_id, pkt.pkt_id, wait)
+
+    async def send_ascii(
+        self,
+        dev_id: int | str,
+        text: str,
+        pkt_id: int = None,
+        wait: float = None,
+        ttl: int = None,
+        priority: bool = False,
+        replace: bool = False,
+    ) -> dict:
+        if pkt_id is None:
+            pkt_id = np.random.randint(0, 2**16)
+        pkt = PacketApiSend(
+            data=encode_data(bytes(text, encoding="utf-8")), pkt_id=pkt_id, ttl=ttl, priority=priority, replace=replace
+        )
+        return await self.send_packet(dev_id, pkt, wait)
+
+    async def send_many(self, pkts: Iterable[Tuple[int | str, PacketApiSend]], wait: float = None) -> list:
+        """Sends the packets to their devices concurrently.
+
+        Returns the result of send_packet() or the exception raised by it for every packet in the order of pkts, so
+        that a failure for one device does not hide the results for the others.
+        """
+        sends = (self.send_packet(dev_id, pkt, wait) for dev_id, pkt in pkts)
+        return await asyncio.gather(*sends, return_exceptions=True)
+
+    async def get_delivery(self, dev_id: int | str, pkt_id: int, wait: float = 0.0) -> dict:
+        """Reads the delivery status of a packet sent to the device, waiting up to wait seconds while it is pending."""
+        dev_id = to_dev_id_b64(dev_id)
+        timeout = httpx.Timeout(wait + 10.0, pool=None)
+        r = await self.__client.get(f"/out/{dev_id}/{pkt_id}", params={"wait": wait}, timeout=timeout)
+        r.raise_for_status()
+        return r.json()
+
+    async def get_packets(self, dev_id: int | str = None) -> List[PacketApiReceive]:
+        """Retrieves all packets of the device or all devices."""
+        dev_path = "all" if dev_id is None else to_dev_id_b64(dev_id)
+        r = await self.__client.get(f"/in/{dev_path}/all")
+        r.raise_for_status()
+        return [PacketApiReceive.from_json(json_dict) for json_dict in r.json()]
+
+    async def query(self, dev_id: int | str = None, since: float = None, until: float = None, page_size: int = 1000):
+        """Retrieves the packets of the device or all devices received in the time range like GatewayClient.query()."""
+        dev_path = "all" if dev_id is None else to_dev_id_b64(dev_id)
+        params = {"limit": page_size}
+        if since is not None:
+            params["since"] = since
+        if until is not None:
+            params["until"] = until
+        while True:
+            r = await self.__client.get(f"/in/{dev_path}", params=params)
+            r.raise_for_status()
+            page = r.json()
+            for json_dict in page["packets"]:
+                yield PacketApiReceive.from_json(json_dict)
+            if not page["more"]:
+                return
+            params["after_cursor"] = page["cursor"]
+
+    async def export(self, dev_id: int | str = None, since: float = None, until: float = None) -> dict:
+        """Retrieves the packets of the device or all devices received in the time range as numpy arrays."""
+        dev_path = "all" if dev_id is None else to_dev_id_b64(dev_id)
+        params = dict()
+        if since is not None:
+            params["since"] = since
+        if until is not None:
+            params["until"] = until
+        r = await self.__client.get(f"/in/{dev_path}/export", params=params)
+        r.raise_for_status()
+        with np.load(io.BytesIO(r.content)) as npz:
+            return {name: npz[name] for name in npz.files}
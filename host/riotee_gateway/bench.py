@@ -0,0 +1,192 @@
+"""End-to-end benchmark of server and client with an emulated transceiver."""
+import asyncio
+import base64
+import resource
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+import requests
+
+from riotee_gateway.client import GatewayClient
+from riotee_gateway.emulator import SEND_TIME
+from riotee_gateway.emulator import DongleEmulator
+from riotee_gateway.emulator import LoadProfile
+
+
+def percentile(values, q: float) -> float:
+    if not values:
+        return float("nan")
+    values = sorted(values)
+    return values[min(len(values) - 1, int(q * len(values)))]
+
+
+class EmulatorThread(threading.Thread):
+    """Runs a DongleEmulator with its own event loop."""
+
+    def __init__(self, emulator: DongleEmulator):
+        super().__init__(daemon=True)
+        self.emulator = emulator
+        self.__loop = asyncio.new_event_loop()
+        self.__task = None
+
+    def run(self):
+        self.__task = self.__loop.create_task(self.emulator.run())
+        try:
+            self.__loop.run_until_complete(self.__task)
+        except asyncio.CancelledError:
+            pass
+
+    def stop(self):
+        self.__loop.call_soon_threadsafe(self.__task.cancel)
+        self.join()
+
+
+def start_server(device: str, port: int, store: str) -> subprocess.Popen:
+    cmd = [sys.executable, "-m", "riotee_gateway.cli", "-v", "server"]
+    cmd += ["-d", device, "-p", str(port), "-h", "127.0.0.1", "--store", store]
+    server = subprocess.Popen(cmd)
+    for _ in range(100):
+        try:
+            requests.get(f"http://127.0.0.1:{port}/", timeout=1.0)
+            return server
+        except requests.ConnectionError:
+            time.sleep(0.1)
+    server.terminate()
+    raise Exception("Server did not start")
+
+
+def run_benchmark(profile: LoadProfile, duration: float, interval: float = 5.0, port: int = 8123, report=print):
+    """Runs emulator, server and a streaming client and reports ingest rate, latency and memory.
+
+    Latency is measured from the creation of a packet in the emulator until the client receives it from the stream.
+    Returns the summary of the whole run.
+    """
+    emulator = DongleEmulator(profile)
+    device = emulator.open()
+    emulator_thread = EmulatorThread(emulator)
+
+    with tempfile.TemporaryDirectory() as store:
+        server = start_server(device, port, store)
+        client = GatewayClient("127.0.0.1", port)
+        emulator_thread.start()
+        try:
+            latencies = list()
+            interval_latencies = list()
+            t_start = time.time()
+            t_report = t_start + interval
+            report(f"{'time':>6} {'pkts/s':>9} {'p50 ms':>8} {'p99 ms':>8} {'server MiB':>11} {'client MiB':>11}")
+            for _, pkt in client.subscribe():
+                now = time.time()
+                send_time = SEND_TIME.unpack_from(base64.urlsafe_b64decode(pkt.data))[0]
+                interval_latencies.append(now - send_time)
+
+                if now >= t_report:
+                    server_rss = client.get_stats()["server"].get("rss_bytes") or 0
+                    client_rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss * 1024
+                    report(
+                        f"{now - t_start:6.0f} {len(interval_latencies) / interval:9.1f} "
+                        f"{percentile(interval_latencies, 0.5) * 1e3:8.2f} "
+                        f"{percentile(interval_latencies, 0.99) * 1e3:8.2f} "
+                        f"{server_rss / 2**20:11.1f} {client_rss / 2**20:11.1f}"
+                    )
+                    latencies += interval_latencies
+                    interval_latencies = list()
+                    t_report += interval
+                if now - t_start >= duration:
+                    break
+        finally:
+            emulator_thread.stop()
+            server.terminate()
+            server.wait()
+            emulator.close()
+
+    latencies += interval_latencies
+    summary = {
+        "sent": emulator.stats["sent"],
+        "received": len(latencies),
+        "rate": len(latencies) / duration,
+        "latency_ms": {q: percentile(latencies, q) * 1e3 for q in (0.5, 0.9, 0.99, 1.0)},
+    }
+    report(
+        f"Received {summary['received']} of {summary['sent']} packets ({summary['rate']:.1f}/s). Latency p50 "
+        f"{summary['latency_ms'][0.5]:.2f} ms, p90 {summary['latency_ms'][0.9]:.2f} ms, p99 "
+        f"{summary['latency_ms'][0.99]:.2f} ms, max {summary['latency_ms'][1.0]:.2f} ms"
+    )
+    return summary
+
+
+def time_request(session: requests.Session, method: str, url: str, **kwargs):
+    """Returns the response time in s and the size of the response body."""
+    t_start = time.perf_counter()
+    r = session.request(method, url, **kwargs)
+    r.raise_for_status()
+    return time.perf_counter() - t_start, len(r.content)
+
+
+def run_queue_benchmark(profile: LoadProfile, n_packets: int, port: int = 8123, report=print):
+    """Measures the ingest rate and the response times of the API with n_packets queued on the server.
+
+    The packets come from the emulator, which is stopped once n_packets are stored, so that all requests see the same
+    queue. Returns the summary.
+    """
+    emulator = DongleEmulator(profile)
+    device = emulator.open()
+    emulator_thread = EmulatorThread(emulator)
+    url = f"http://127.0.0.1:{port}"
+
+    with tempfile.TemporaryDirectory() as store, requests.Session() as session:
+        server = start_server(device, port, store)
+        client = GatewayClient("127.0.0.1", port)
+        try:
+            t_start = time.perf_counter()
+            emulator_thread.start()
+            n_stored = 0
+            while n_stored < n_packets:
+                time.sleep(0.5)
+                n_stored = session.get(f"{url}/in/all/size").json()
+            ingest_time = time.perf_counter() - t_start
+            emulator_thread.stop()
+            # Wait for the packets that were still on the way
+            while (n := session.get(f"{url}/in/all/size").json()) != n_stored:
+                n_stored = n
+                time.sleep(0.5)
+            report(f"Stored {n_stored} packets at {n_stored / ingest_time:.1f} packets/s")
+
+            dev_id = session.get(f"{url}/devices").json()[0]
+            requests_timed = [
+                ("GET /in/all/all", "GET", f"{url}/in/all/all", {}),
+                ("GET /in/{dev_id}/all", "GET", f"{url}/in/{dev_id}/all", {}),
+                ("GET /in/{dev_id}/0", "GET", f"{url}/in/{dev_id}/0", {}),
+                ("GET /in/all?limit=1000", "GET", f"{url}/in/all", {"params": {"limit": 1000}}),
+                ("GET /in/{dev_id}?limit=1000", "GET", f"{url}/in/{dev_id}", {"params": {"limit": 1000}}),
+                ("GET /in/all/export", "GET", f"{url}/in/all/export", {}),
+                ("POST /in/all/drain?max=1000", "POST", f"{url}/in/all/drain", {"params": {"max": 1000}}),
+            ]
+            response_times = dict()
+            report(f"{'request':<30} {'ms':>9} {'KiB':>9}")
+            for name, method, request_url, kwargs in requests_timed:
+                duration, size = time_request(session, method, request_url, **kwargs)
+                response_times[name] = duration
+                report(f"{name:<30} {duration * 1e3:9.2f} {size / 1024:9.1f}")
+
+            t_drain = time.perf_counter()
+            n_drained = sum(1 for _ in client.drain(max_pkts=1000))
+            drain_time = time.perf_counter() - t_drain
+            report(f"Drained {n_drained} packets in {drain_time:.2f} s ({n_drained / drain_time:.1f} packets/s)")
+        finally:
+            if emulator_thread.is_alive():
+                emulator_thread.stop()
+            client.close()
+            server.terminate()
+            server.wait()
+            emulator.close()
+
+    return {
+        "stored": n_stored,
+        "ingest_rate": n_stored / ingest_time,
+        "response_ms": {name: duration * 1e3 for name, duration in response_times.items()},
+        "drain_rate": n_drained / drain_time,
+    }
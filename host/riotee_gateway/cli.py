@@ -1,13 +1,26 @@
+import asyncio
 import click
 import logging
 import uvicorn
+from riotee_gateway.async_client import AsyncGatewayClient
 from riotee_gateway.client import GatewayClient
+from riotee_gateway.client import encode_data
 import riotee_gateway.server
 from riotee_gateway import Transceiver
+from riotee_gateway.bench import run_benchmark
+from riotee_gateway.bench import run_queue_benchmark
+from riotee_gateway.emulator import DongleEmulator
+from riotee_gateway.emulator import LoadProfile
+from riotee_gateway.framing import Rate
+from riotee_gateway.packet_model import PacketApiSend
+from riotee_gateway.pool import TransceiverPool
+from riotee_gateway.store import PacketStore
 import time
 import signal
 import sys
 import json
+import numpy as np
+from pathlib import Path
 
 
 @click.option("-v", "--verbose", count=True, default=2)
@@ -29,14 +42,51 @@ def cli(ctx, verbose):
     "--device",
     "-d",
     type=click.Path(exists=True),
-    required=False,
-    help="Path to USB device (/dev/ttyACMx or COMX)",
+    multiple=True,
+    help="Path to USB device (/dev/ttyACMx or COMX). Repeat for several dongles. Uses all dongles found if omitted.",
 )
 @click.option("-p", "--port", type=int, default=8000, help="Port for API server")
 @click.option("-h", "--host", type=str, default="0.0.0.0", help="Host for API server")
+@click.option(
+    "-s",
+    "--store",
+    type=click.Path(file_okay=False),
+    default="~/.riotee-gateway",
+    help="Directory where received packets are stored",
+)
+@click.option("--retention-age", type=float, help="Delete packets older than this many hours")
+@click.option("--retention-size", type=int, help="Limit the size of the packet store to this many MiB")
+@click.option(
+    "--dedup-window", type=float, default=2.0, help="Drop packets received again by another dongle within this many s"
+)
+@click.option(
+    "--channel",
+    type=click.IntRange(0, 100),
+    multiple=True,
+    help="Radio channel in MHz above 2400 MHz. Repeat to hop between channels. Keeps the dongle's setting if omitted.",
+)
+@click.option("--rate", type=click.Choice([r.name for r in Rate]), default=Rate.BLE_1MBIT.name, help="Radio data rate")
+@click.option("--dwell", type=int, default=100, help="Time in ms spent on each channel when hopping")
+@click.option(
+    "--delivery-timeout", type=float, default=60.0, help="Report packets for devices as expired after this many s"
+)
 @click.pass_context
-def server(ctx, device, port, host):
-    riotee_gateway.server.tcv = Transceiver(port=device)
+def server(
+    ctx, device, port, host, store, retention_age, retention_size, dedup_window, channel, rate, dwell, delivery_timeout
+):
+    if not device:
+        device = Transceiver.find_serial_ports()
+    tcvs = [Transceiver(port=dev) for dev in device]
+    radio = None
+    if channel:
+        radio = {"rate": Rate[rate], "channels": list(channel), "dwell_ms": dwell}
+    riotee_gateway.server.pool = TransceiverPool(tcvs, dedup_window, radio, delivery_timeout)
+    pkt_store = PacketStore(
+        Path(store).expanduser(),
+        max_age=retention_age * 3600 if retention_age is not None else None,
+        max_bytes=retention_size * 1024 * 1024 if retention_size is not None else None,
+    )
+    riotee_gateway.server.db = riotee_gateway.server.PacketDatabase(pkt_store)
     uvicorn.run("riotee_gateway.server:app", port=port, host=host)
 
 
@@ -45,7 +95,8 @@ def server(ctx, device, port, host):
 @click.option("-h", "--host", type=str, default="localhost", help="Host for API server")
 @click.pass_context
 def client(ctx, host, port):
-    ctx.obj["client"] = GatewayClient(host, port)
+    ctx.obj["client"] = ctx.with_resource(GatewayClient(host, port))
+    ctx.obj["address"] = (host, port)
 
 
 @client.command(short_help="fetch packets from the server")
@@ -73,19 +124,52 @@ def devices(ctx):
 
 
 @client.command(short_help="send ascii message to device")
-@click.option("-d", "--device", type=str)
+@click.option(
+    "-d",
+    "--device",
+    type=str,
+    multiple=True,
+    required=True,
+    help="Device ID. Sends to all devices at once if repeated.",
+)
 @click.option("-m", "--message", type=str)
+@click.option("-w", "--wait", type=float, help="Wait up to this many s for the delivery and print its status")
+@click.option("--ttl", type=click.IntRange(1, 65535), help="Discard the message if not delivered within this many s")
+@click.option("--priority", is_flag=True, help="Deliver before other messages queued for the device")
+@click.option("--replace", is_flag=True, help="Supersede queued messages for the device that were sent with --replace")
 @click.pass_context
-def send(ctx, device, message):
-    ctx.obj["client"].send_ascii(device, message)
-
-
-@client.command(short_help="continuously poll the server for packets")
-@click.option("-d", "--device", type=str, required=True)
-@click.option("-i", "--interval", type=float, default=0.1)
+def send(ctx, device, message, wait, ttl, priority, replace):
+    if len(device) == 1:
+        delivery = ctx.obj["client"].send_ascii(device[0], message, None, wait, ttl, priority, replace)
+        if delivery is not None:
+            click.echo(delivery["status"])
+        return
+
+    pkt = PacketApiSend(
+        data=encode_data(bytes(message, encoding="utf-8")),
+        pkt_id=np.random.randint(0, 2**16),
+        ttl=ttl,
+        priority=priority,
+        replace=replace,
+    )
+
+    async def send_all():
+        async with AsyncGatewayClient(*ctx.obj["address"]) as client:
+            return await client.send_many(((dev_id, pkt) for dev_id in device), wait)
+
+    for dev_id, result in zip(device, asyncio.run(send_all())):
+        if isinstance(result, Exception):
+            click.echo(f"{dev_id}: failed ({result})")
+        elif result is not None:
+            click.echo(f"{dev_id}: {result['status']}")
+
+
+@client.command(short_help="continuously stream packets from the server")
+@click.option("-d", "--device", type=str, multiple=True, help="Device ID to monitor. Monitors all devices if omitted.")
+@click.option("-c", "--cursor", type=int, help="Start with the stored packets after this cursor")
 @click.option("-o", "--output", type=click.Path())
 @click.pass_context
-def monitor(ctx, device, interval, output):
+def monitor(ctx, device, cursor, output):
     if output:
         f = open(output, "w+")
 
@@ -96,13 +180,48 @@ def monitor(ctx, device, interval, output):
 
     signal.signal(signal.SIGINT, stop_loop)
 
-    while True:
-        for pkt in ctx.obj["client"].pops(device):
-            click.echo(pkt.to_json())
-            if output:
-                f.writelines(json.dumps(pkt.to_json()) + "\n")
+    for _, pkt in ctx.obj["client"].subscribe(device or None, cursor):
+        click.echo(pkt.to_json())
+        if output:
+            f.writelines(json.dumps(pkt.to_json()) + "\n")
+
 
-        time.sleep(interval)
+def load_profile_options(func):
+    """Options describing the traffic of emulated devices."""
+    func = click.option("-b", "--burst", type=int, default=1, help="Packets sent back-to-back by a device")(func)
+    func = click.option("-s", "--payload-size", type=int, default=32, help="Payload size in bytes")(func)
+    func = click.option("-r", "--rate", type=float, default=1.0, help="Average packets per second per device")(func)
+    func = click.option("-n", "--n-devices", type=int, default=10, help="Number of emulated devices")(func)
+    return func
+
+
+@cli.command(short_help="emulate a dongle on a pseudo terminal")
+@load_profile_options
+@click.option("--seed", type=int, help="Seed for reproducible traffic")
+def emulate(n_devices, rate, payload_size, burst, seed):
+    emulator = DongleEmulator(LoadProfile(n_devices, rate, payload_size, burst), seed)
+    click.echo(f"Emulated dongle at {emulator.open()}")
+    try:
+        asyncio.run(emulator.run())
+    except KeyboardInterrupt:
+        pass
+    finally:
+        emulator.close()
+        click.echo(f"Sent {emulator.stats['sent']} packets")
+
+
+@cli.command(short_help="benchmark server and client with an emulated dongle")
+@load_profile_options
+@click.option("-t", "--duration", type=float, default=60.0, help="Duration of the benchmark in s")
+@click.option("-i", "--interval", type=float, default=5.0, help="Reporting interval in s")
+@click.option("-p", "--port", type=int, default=8123, help="Port for the API server")
+@click.option("-q", "--queued", type=int, help="Instead, time the API with this many packets queued on the server")
+def bench(n_devices, rate, payload_size, burst, duration, interval, port, queued):
+    profile = LoadProfile(n_devices, rate, payload_size, burst)
+    if queued is not None:
+        run_queue_benchmark(profile, queued, port, report=click.echo)
+    else:
+        run_benchmark(profile, duration, interval, port, report=click.echo)
 
 
 if __name__ == "__main__":
@@ -1,12 +1,22 @@
 import requests
 import numpy as np
 import base64
+import functools
+import io
+import json
+import logging
+import struct
+import time
 from typing import List
 
 from riotee_gateway.packet_model import PacketApiSend
 from riotee_gateway.packet_model import PacketApiReceive
 
 
+# Attempts to send a packet while the transceiver is busy
+SEND_RETRIES = 5
+
+
 def decode_dev_id(dev_id_b64: str):
     return np.frombuffer(base64.urlsafe_b64decode(dev_id_b64), dtype=np.uint16)[0]
 
@@ -15,52 +25,114 @@ def encode_data(data: bytes) -> bytes:
     return base64.urlsafe_b64encode(data)
 
 
+@functools.lru_cache(maxsize=4096)
+def encode_dev_id(dev_id: int) -> str:
+    return str(encode_data(struct.pack("<I", dev_id)), "utf-8")
+
+
+def to_dev_id_b64(dev_id: int | str) -> str:
+    if type(dev_id) is str:
+        return dev_id
+    return encode_dev_id(dev_id)
+
+
 class GatewayClient(object):
+    """Client for the API of the gateway server.
+
+    All requests go through one session, which keeps the connections to the server open between requests.
+    """
+
     def __init__(self, host: str = "localhost", port: int = 8000):
         self.__url = f"http://{host}:{port}"
+        self.__session = requests.Session()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def close(self):
+        self.__session.close()
 
     def convert_dev_id(fn_called):
         """Automatically converts dev_id argument to base64"""
 
-        def _convert_dev_id_wrapped(self, dev_id: int | str, *args):
+        def _convert_dev_id_wrapped(self, dev_id: int | str, *args, **kwargs):
             if dev_id is None:
-                return fn_called(self, None, *args)
-            if type(dev_id) is str:
-                return fn_called(self, dev_id, *args)
-            dev_id_b64 = encode_data(np.uint32(dev_id))
-            return fn_called(self, dev_id_b64, *args)
+                return fn_called(self, None, *args, **kwargs)
+            return fn_called(self, to_dev_id_b64(dev_id), *args, **kwargs)
 
         return _convert_dev_id_wrapped
 
     def get_devices(self) -> List[str]:
         """Reads the list of all devices from which the gateway has received packets."""
-        r = requests.get(f"{self.__url}/devices")
+        r = self.__session.get(f"{self.__url}/devices")
+        r.raise_for_status()
+        return r.json()
+
+    def get_stats(self) -> dict:
+        """Reads the packet counters of the transceiver pipeline stages and the server."""
+        r = self.__session.get(f"{self.__url}/stats")
         r.raise_for_status()
         return r.json()
 
     @convert_dev_id
-    def send_packet(self, dev_id: int | str, pkt: PacketApiSend):
-        r = requests.post(f"{self.__url}/out/{dev_id}", data=pkt.model_dump_json())
+    def send_packet(self, dev_id: int | str, pkt: PacketApiSend, wait: float = None) -> dict:
+        """Sends the packet to the device.
+
+        If wait is given, waits up to wait seconds for the delivery and returns the delivery status. Sending the same
+        packet again while it is pending does not queue another copy, so it is safe to retry. If the transceiver is
+        busy, the packet is sent again after the delay requested by the server.
+        """
+        for _ in range(SEND_RETRIES):
+            r = self.__session.post(f"{self.__url}/out/{dev_id}", data=pkt.model_dump_json())
+            if r.status_code != 503:
+                break
+            time.sleep(float(r.headers.get("Retry-After", 1)))
         r.raise_for_status()
+        if wait is not None:
+            return self.get_delivery(dev_id, pkt.pkt_id, wait)
 
     @convert_dev_id
-    def send_ascii(self, dev_id: int | str, text: str, pkt_id: int = None):
+    def send_ascii(
+        self,
+        dev_id: int | str,
+        text: str,
+        pkt_id: int = None,
+        wait: float = None,
+        ttl: int = None,
+        priority: bool = False,
+        replace: bool = False,
+    ) -> dict:
         if pkt_id is None:
             pkt_id = np.random.randint(0, 2**16)
-        pkt = PacketApiSend(data=encode_data(bytes(text, encoding="utf-8")), pkt_id=pkt_id)
-        self.send_packet(dev_id, pkt)
+        pkt = PacketApiSend(
+            data=encode_data(bytes(text, encoding="utf-8")), pkt_id=pkt_id, ttl=ttl, priority=priority, replace=replace
+        )
+        return self.send_packet(dev_id, pkt, wait)
+
+    @convert_dev_id
+    def get_delivery(self, dev_id: int | str, pkt_id: int, wait: float = 0.0) -> dict:
+        """Reads the delivery status of a packet sent to the device, waiting up to wait seconds while it is pending.
+
+        The status is one of pending, delivered, rejected or expired.
+        """
+        r = self.__session.get(f"{self.__url}/out/{dev_id}/{pkt_id}", params={"wait": wait}, timeout=wait + 10.0)
+        r.raise_for_status()
+        return r.json()
 
     @convert_dev_id
     def get_queue_size(self, dev_id: int | str) -> int:
         """Reads the number of packets in the queue for the corresponding device."""
-        r = requests.get(f"{self.__url}/in/{dev_id}/size")
+        r = self.__session.get(f"{self.__url}/in/{dev_id}/size")
         r.raise_for_status()
         return int(r.json())
 
     @convert_dev_id
     def get_packet(self, dev_id: int | str, pkt_index: int) -> PacketApiReceive:
         """Retrieves a packet from the gateway's fifo queue."""
-        r = requests.get(f"{self.__url}/in/{dev_id}/{pkt_index}")
+        r = self.__session.get(f"{self.__url}/in/{dev_id}/{pkt_index}")
         r.raise_for_status()
 
         return PacketApiReceive.from_json(r.json())
@@ -68,7 +140,7 @@ class GatewayClient(object):
     @convert_dev_id
     def delete_packet(self, dev_id: int | str, pkt_index: int):
         """Retrieves a packet from the gateway's fifo queue."""
-        r = requests.delete(f"{self.__url}/in/{dev_id}/{pkt_index}")
+        r = self.__session.delete(f"{self.__url}/in/{dev_id}/{pkt_index}")
         r.raise_for_status()
         return r.json()
 
@@ -87,19 +159,81 @@ class GatewayClient(object):
     @convert_dev_id
     def pops(self, dev_id: int | str):
         """Pops all packets from the gateway's fifo queue for the specified device."""
+        yield from self.drain(dev_id)
+
+    @convert_dev_id
+    def drain(self, dev_id: int | str = None, max_pkts: int = 100):
+        """Retrieves and deletes all packets of the device or all devices in batches.
+
+        A batch is only deleted on the server when the next batch is requested, i.e., after all packets of the batch
+        have been consumed. If the client stops before, the remaining packets stay on the server. Nothing is returned
+        for a device the server has not received any packets from.
+        """
+        dev_path = "all" if dev_id is None else dev_id
+        cursor = None
         while True:
-            try:
-                yield self.pop(dev_id)
-            except IndexError:
+            params = {"max": max_pkts}
+            if cursor is not None:
+                params["ack"] = cursor
+            r = self.__session.post(f"{self.__url}/in/{dev_path}/drain", params=params)
+            if r.status_code == 404:
+                return
+            r.raise_for_status()
+            batch = r.json()
+            if not batch["packets"]:
+                return
+            for json_dict in batch["packets"]:
+                yield PacketApiReceive.from_json(json_dict)
+            cursor = batch["cursor"]
+
+    @convert_dev_id
+    def query(self, dev_id: int | str = None, since: float = None, until: float = None, page_size: int = 1000):
+        """Retrieves the packets of the device or all devices received in the time range ordered by their timestamps.
+
+        Times are in seconds since the epoch. The packets are fetched page by page while they are consumed.
+        """
+        dev_path = "all" if dev_id is None else dev_id
+        params = {"limit": page_size}
+        if since is not None:
+            params["since"] = since
+        if until is not None:
+            params["until"] = until
+        while True:
+            r = self.__session.get(f"{self.__url}/in/{dev_path}", params=params)
+            r.raise_for_status()
+            page = r.json()
+            for json_dict in page["packets"]:
+                yield PacketApiReceive.from_json(json_dict)
+            if not page["more"]:
                 return
+            params["after_cursor"] = page["cursor"]
+
+    @convert_dev_id
+    def export(self, dev_id: int | str = None, since: float = None, until: float = None) -> dict:
+        """Retrieves the packets of the device or all devices received in the time range as numpy arrays.
+
+        Returns the columns dev_id, pkt_id, ack_id, dongle_timestamp_us, timestamp, data_offsets and data ordered by the
+        timestamps. The payloads are concatenated in data, the payload of packet i spans from data_offsets[i] to
+        data_offsets[i + 1].
+        """
+        dev_path = "all" if dev_id is None else dev_id
+        params = dict()
+        if since is not None:
+            params["since"] = since
+        if until is not None:
+            params["until"] = until
+        r = self.__session.get(f"{self.__url}/in/{dev_path}/export", params=params)
+        r.raise_for_status()
+        with np.load(io.BytesIO(r.content)) as npz:
+            return {name: npz[name] for name in npz.files}
 
     @convert_dev_id
     def get_packets(self, dev_id: int | str = None) -> List[PacketApiReceive]:
         """Retrieves all packets from all the gateway's fifo queues."""
         if dev_id is None:
-            r = requests.get(f"{self.__url}/in/all/all")
+            r = self.__session.get(f"{self.__url}/in/all/all")
         else:
-            r = requests.get(f"{self.__url}/in/{dev_id}/all")
+            r = self.__session.get(f"{self.__url}/in/{dev_id}/all")
         r.raise_for_status()
         return [PacketApiReceive.from_json(json_dict) for json_dict in r.json()]
 
@@ -107,8 +241,46 @@ class GatewayClient(object):
     def delete_packets(self, dev_id: int | str = None):
         """Deletes all packets from all the gateway's fifo queues."""
         if dev_id is None:
-            r = requests.delete(f"{self.__url}/in/all/all")
+            r = self.__session.delete(f"{self.__url}/in/all/all")
         else:
-            r = requests.delete(f"{self.__url}/in/{dev_id}/all")
+            r = self.__session.delete(f"{self.__url}/in/{dev_id}/all")
         r.raise_for_status()
         return r.json()
+
+    def subscribe(self, dev_ids: List[int | str] = None, cursor: int = None, reconnect_delay: float = 1.0):
+        """Yields cursor and packet for every packet received from the specified devices or all devices.
+
+        Without a cursor, only packets that arrive after subscribing are returned. Otherwise, all stored packets after
+        the cursor are returned first. The client reconnects and resumes from the last cursor if the connection is lost
+        or the server drops the stream because the client did not keep up.
+        """
+        params = dict()
+        if dev_ids is not None:
+            params["device"] = [to_dev_id_b64(dev_id) for dev_id in dev_ids]
+
+        while True:
+            if cursor is not None:
+                params["cursor"] = cursor
+            try:
+                # The server sends keepalives, so a long silence means that the connection is dead
+                with self.__session.get(f"{self.__url}/stream", params=params, stream=True, timeout=(5.0, 60.0)) as r:
+                    r.raise_for_status()
+                    event = dict()
+                    for line in r.iter_lines(decode_unicode=True):
+                        if line:
+                            if not line.startswith(":"):
+                                field, _, value = line.partition(":")
+                                event[field] = value.lstrip(" ")
+                            continue
+
+                        if "id" in event:
+                            cursor = int(event["id"])
+                        if event.get("event") == "packet":
+                            yield cursor, PacketApiReceive.from_json(json.loads(event["data"]))
+                        elif event.get("event") == "overflow":
+                            logging.warning("Stream fell behind. Resuming.")
+                            break
+                        event = dict()
+            except (requests.ConnectionError, requests.Timeout) as e:
+                logging.warning(f"Lost connection to server: {e}")
+                time.sleep(reconnect_delay)
@@ -0,0 +1,83 @@
+"""Mapping of the transceiver clock to host wall-clock time."""
+import logging
+from collections import deque
+
+# Largest plausible frequency deviation between the clocks of transceiver and host
+MAX_DRIFT = 500e-6
+# Deviation in s of a sample from the estimate, beyond the uncertainty of its round trip, after which one of the
+# clocks is assumed to have jumped
+MAX_RESIDUAL = 0.05
+
+
+class ClockSync(object):
+    """Estimates offset and drift of the microsecond clock of a transceiver relative to the host clock.
+
+    Each sample is a request with the host time when it was sent, the host time when the answer arrived and the
+    transceiver time in the answer. The transceiver time is assumed to belong to the middle of the round trip, so the
+    samples with the shortest round trip are the most accurate ones. The offset is taken from the best sample of the
+    window and the drift from the best samples of its older and newer half. The window starts over when the
+    transceiver clock restarts, e.g., after a reboot of the transceiver, or either clock jumps.
+    """
+
+    def __init__(self, window: int = 16):
+        self.__samples = deque(maxlen=window)
+        # Result of the last fit
+        self.__ref = None
+        self.__rate = 1.0
+
+    def __len__(self):
+        return len(self.__samples)
+
+    def add(self, t_send: float, t_recv: float, dongle_us: int):
+        sample = (dongle_us * 1e-6, (t_send + t_recv) / 2, t_recv - t_send)
+        if self.__samples and self.__jumped(sample):
+            logging.info("Transceiver clock jumped. Restarting the clock synchronization.")
+            self.__samples.clear()
+        self.__samples.append(sample)
+        self.__ref, self.__rate = self.__fit()
+
+    def __jumped(self, sample) -> bool:
+        """Tells whether the sample does not fit the samples in the window."""
+        if sample[0] < self.__samples[-1][0]:
+            return True
+        return abs(sample[1] - self.__wall(sample[0])) > sample[2] / 2 + MAX_RESIDUAL
+
+    @staticmethod
+    def __best(samples):
+        return min(samples, key=lambda sample: sample[2])
+
+    def __fit(self):
+        """Returns reference sample and rate of the host clock relative to the transceiver clock."""
+        ref = self.__best(self.__samples)
+        if len(self.__samples) < 4:
+            return ref, 1.0
+
+        samples = list(self.__samples)
+        old = self.__best(samples[: len(samples) // 2])
+        new = self.__best(samples[len(samples) // 2 :])
+        if new[0] == old[0]:
+            return ref, 1.0
+        rate = (new[1] - old[1]) / (new[0] - old[0])
+        # A bad estimate from too close or too noisy samples must not distort the timestamps
+        if abs(rate - 1.0) > MAX_DRIFT:
+            rate = 1.0
+        return ref, rate
+
+    def to_wall(self, dongle_us: int) -> float:
+        """Converts a transceiver timestamp to host time in seconds since the epoch or None if not synchronized."""
+        if self.__ref is None:
+            return None
+        return self.__wall(dongle_us * 1e-6)
+
+    def __wall(self, dongle_time: float) -> float:
+        return self.__ref[1] + (dongle_time - self.__ref[0]) * self.__rate
+
+    @property
+    def stats(self) -> dict:
+        if self.__ref is None:
+            return None
+        return {
+            "offset": self.__ref[1] - self.__ref[0],
+            "drift_ppm": (self.__rate - 1.0) * 1e6,
+            "rtt_ms": self.__ref[2] * 1e3,
+        }
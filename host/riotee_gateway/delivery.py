@@ -0,0 +1,153 @@
+"""Tracking of the delivery of downlink packets to the devices."""
+import asyncio
+import time
+from collections import OrderedDict
+from enum import Enum
+
+from riotee_gateway.framing import DiscardReason
+
+
+class DeliveryStatus(str, Enum):
+    # Queued on the transceiver until the device sends the next packet
+    PENDING = "pending"
+    # Sent to the device as acknowledgement of one of its packets
+    DELIVERED = "delivered"
+    # The transceiver could not queue the packet
+    REJECTED = "rejected"
+    # Not delivered within the timeout
+    EXPIRED = "expired"
+    # Discarded in favour of a newer packet sent with the replace flag
+    SUPERSEDED = "superseded"
+
+
+class Delivery(object):
+    __slots__ = ("status", "t_sent", "t_done", "retries", "err", "done")
+
+    def __init__(self, t_sent: float):
+        self.status = DeliveryStatus.PENDING
+        self.t_sent = t_sent
+        self.t_done = None
+        self.retries = 0
+        self.err = None
+        self.done = asyncio.Event()
+
+    def to_dict(self) -> dict:
+        return {
+            "status": self.status,
+            "sent": self.t_sent,
+            "done": self.t_done,
+            "retries": self.retries,
+            "err": self.err,
+        }
+
+
+class DeliveryTracker(object):
+    """Keeps the delivery status of downlink packets, reported by the transceivers.
+
+    A packet is pending from when it is sent to a transceiver until the transceiver reports its delivery or rejection,
+    or until the timeout expires. Packets that are sent again while they are pending are not passed on to the
+    transceiver, because it still holds the first copy. Finished packets are remembered for keep seconds.
+    """
+
+    def __init__(self, timeout: float = 60.0, keep: float = 600.0):
+        self.__timeout = timeout
+        self.__keep = keep
+        # Maps (dev_id, pkt_id) to the Delivery, oldest first
+        self.__pending = OrderedDict()
+        # Same for finished deliveries in the order they finished
+        self.__finished = OrderedDict()
+        self.__stats = dict.fromkeys(("delivered", "rejected", "expired", "superseded", "retries", "suppressed"), 0)
+
+    def __finish(self, key, delivery: Delivery, status: DeliveryStatus, now: float):
+        delivery.status = status
+        delivery.t_done = now
+        delivery.done.set()
+        self.__finished[key] = delivery
+        self.__stats[status.value] += 1
+
+    def sweep(self, now: float = None):
+        """Expires pending packets after the timeout and forgets finished packets after keep seconds."""
+        if now is None:
+            now = time.time()
+        while self.__pending:
+            key, delivery = next(iter(self.__pending.items()))
+            if now - delivery.t_sent < self.__timeout:
+                break
+            del self.__pending[key]
+            self.__finish(key, delivery, DeliveryStatus.EXPIRED, now)
+        while self.__finished:
+            key, delivery = next(iter(self.__finished.items()))
+            if now - delivery.t_done < self.__keep:
+                break
+            del self.__finished[key]
+
+    def track(self, dev_id: bytes, pkt_id: int, now: float = None) -> bool:
+        """Registers a downlink packet. Returns False if the same packet is still pending and must not be sent."""
+        if now is None:
+            now = time.time()
+        self.sweep(now)
+
+        key = (dev_id, pkt_id)
+        if (delivery := self.__pending.get(key)) is not None:
+            delivery.retries += 1
+            self.__stats["suppressed"] += 1
+            return False
+
+        retries = 0
+        if (previous := self.__finished.pop(key, None)) is not None:
+            retries = previous.retries + 1
+            self.__stats["retries"] += 1
+        self.__pending[key] = Delivery(now)
+        self.__pending[key].retries = retries
+        return True
+
+    def __report(self, dev_id: bytes, pkt_id: int, status: DeliveryStatus, err: int = None):
+        key = (dev_id, pkt_id)
+        now = time.time()
+        if (delivery := self.__pending.pop(key, None)) is not None:
+            delivery.err = err
+            self.__finish(key, delivery, status, now)
+        elif status == DeliveryStatus.DELIVERED and (delivery := self.__finished.get(key)) is not None:
+            # Late delivery after the timeout
+            if delivery.status == DeliveryStatus.EXPIRED:
+                self.__stats["expired"] -= 1
+                self.__stats["delivered"] += 1
+                delivery.status = status
+                delivery.t_done = now
+                self.__finished.move_to_end(key)
+
+    def delivered(self, dev_id: bytes, pkt_id: int):
+        self.__report(dev_id, pkt_id, DeliveryStatus.DELIVERED)
+
+    def rejected(self, dev_id: bytes, pkt_id: int, err: int):
+        self.__report(dev_id, pkt_id, DeliveryStatus.REJECTED, err)
+
+    def discarded(self, dev_id: bytes, pkt_id: int, reason: DiscardReason):
+        if reason == DiscardReason.REPLACED:
+            self.__report(dev_id, pkt_id, DeliveryStatus.SUPERSEDED)
+        else:
+            self.__report(dev_id, pkt_id, DeliveryStatus.EXPIRED)
+
+    def get(self, dev_id: bytes, pkt_id: int) -> Delivery:
+        """Returns the delivery of the packet. Raises KeyError for unknown packets."""
+        self.sweep()
+        key = (dev_id, pkt_id)
+        if (delivery := self.__pending.get(key)) is not None:
+            return delivery
+        return self.__finished[key]
+
+    async def wait(self, dev_id: bytes, pkt_id: int, timeout: float) -> Delivery:
+        """Waits up to timeout seconds until the packet is no longer pending and returns its delivery."""
+        delivery = self.get(dev_id, pkt_id)
+        if delivery.status == DeliveryStatus.PENDING:
+            # Wake up in time to expire the packet
+            timeout = min(timeout, max(0.0, delivery.t_sent + self.__timeout - time.time()))
+            try:
+                await asyncio.wait_for(delivery.done.wait(), timeout)
+            except asyncio.TimeoutError:
+                self.sweep()
+        return delivery
+
+    @property
+    def stats(self) -> dict:
+        return {"pending": len(self.__pending), **self.__stats}
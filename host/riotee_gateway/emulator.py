@@ -0,0 +1,278 @@
+"""Emulation of the gateway transceiver on a pseudo terminal for testing and benchmarking without radio hardware."""
+import asyncio
+import base64
+import errno
+import heapq
+import logging
+import os
+import random
+import struct
+import time
+import tty
+
+from riotee_gateway.framing import CREDIT
+from riotee_gateway.framing import Command
+from riotee_gateway.framing import DELIVERED
+from riotee_gateway.framing import DISCARDED
+from riotee_gateway.framing import DOWNLINK_OPTS
+from riotee_gateway.framing import DiscardReason
+from riotee_gateway.framing import DownlinkFlag
+from riotee_gateway.framing import FrameError
+from riotee_gateway.framing import FrameType
+from riotee_gateway.framing import Framing
+from riotee_gateway.framing import PACKET_HEADER
+from riotee_gateway.framing import RADIO_CONFIG
+from riotee_gateway.framing import REJECTED
+from riotee_gateway.framing import STATS
+from riotee_gateway.framing import STATS_COUNTERS
+from riotee_gateway.framing import TIME
+from riotee_gateway.framing import decode_command
+from riotee_gateway.framing import encode_event
+from riotee_gateway.framing import frame_encode
+
+# Emulated packets carry the host time of their creation in the first bytes of the payload
+SEND_TIME = struct.Struct("<d")
+# Same limits as the message buffer of the transceiver
+MAX_PKTS_PER_DEVICE = 64
+MSG_DEFAULT_TTL_S = 600
+# Receive window of the transceiver, i.e. 4 of the longest downlink frames, and the data consumed before new credits
+# are reported
+RX_WINDOW = 4 * 354
+CREDIT_REPORT_THRESHOLD = RX_WINDOW // 4
+STATS_INTERVAL = 1.0
+
+
+class LoadProfile(object):
+    """Traffic generated by the emulated devices.
+
+    Every device sends bursts of packets at exponentially distributed intervals, so that the average rate per device
+    matches rate regardless of the burst size.
+    """
+
+    def __init__(self, n_devices: int = 10, rate: float = 1.0, payload_size: int = 32, burst: int = 1):
+        if payload_size < SEND_TIME.size or payload_size > 247:
+            raise ValueError(f"payload size must be between {SEND_TIME.size} and 247")
+        self.n_devices = n_devices
+        self.rate = rate
+        self.payload_size = payload_size
+        self.burst = burst
+
+    def next_burst(self, rng: random.Random) -> float:
+        """Returns the time until the next burst of a device."""
+        return rng.expovariate(self.rate / self.burst)
+
+
+class DongleEmulator(object):
+    """Speaks the protocol of the transceiver firmware on the master side of a pseudo terminal.
+
+    The slave side can be passed to the Transceiver like a serial port. Text and binary framing, commands and downlink
+    packets are supported. Downlink packets are queued per device and acknowledged with the next uplink packet of the
+    device like the radio does.
+    """
+
+    def __init__(self, profile: LoadProfile, seed: int = None):
+        self.__profile = profile
+        self.__rng = random.Random(seed)
+        self.__framing = Framing.TEXT
+        self.__t0 = time.monotonic()
+        self.__master = None
+        self.__slave = None
+        self.__rx_buf = bytearray()
+        # Bytes consumed since the last SET_FRAMING command and at the last credit report
+        self.__rx_consumed = 0
+        self.__rx_consumed_reported = 0
+        self.__devices = [struct.pack("<I", 0x10000000 + idx) for idx in range(profile.n_devices)]
+        self.__pkt_ids = [0] * profile.n_devices
+        # Packet ID, expiry time and flags of the downlink packets queued for each device
+        self.__downlinks = {dev_id: list() for dev_id in self.__devices}
+        self.__counters = dict.fromkeys(STATS_COUNTERS, 0)
+        self.stats = {"sent": 0, "downlink_received": 0, "downlink_delivered": 0}
+
+    def open(self) -> str:
+        """Creates the pseudo terminal and returns the path of its slave side."""
+        self.__master, self.__slave = os.openpty()
+        tty.setraw(self.__slave)
+        os.set_blocking(self.__master, False)
+        return os.ttyname(self.__slave)
+
+    def close(self):
+        os.close(self.__master)
+        os.close(self.__slave)
+
+    def __now_us(self) -> int:
+        return int((time.monotonic() - self.__t0) * 1e6)
+
+    def __write(self, data: bytes) -> bool:
+        """Writes to the host or drops the data if the host does not keep up, like the CDC ACM ringbuffer does."""
+        try:
+            n = os.write(self.__master, data)
+        except BlockingIOError:
+            n = 0
+        if n < len(data):
+            self.__counters["tx_ring_dropped"] += 1
+            # A partially written frame is terminated by the next delimiter on the host side
+            return False
+        return True
+
+    def __send_event(self, evt_type: FrameType, body: bytes):
+        if self.__framing == Framing.BINARY:
+            self.__write(frame_encode(bytes([evt_type]) + body))
+        else:
+            self.__write(encode_event(evt_type, body))
+
+    def __send_packet(self, dev_idx: int):
+        dev_id = self.__devices[dev_idx]
+        pkt_id = self.__pkt_ids[dev_idx]
+        self.__pkt_ids[dev_idx] = (pkt_id + 1) & 0xFFFF
+
+        # The uplink acknowledges the oldest pending downlink packet of the device, which is delivered in turn
+        ack_id = 0xFFFF
+        if self.__downlinks[dev_id]:
+            ack_id, _, _ = self.__downlinks[dev_id].pop(0)
+            self.stats["downlink_delivered"] += 1
+
+        data = SEND_TIME.pack(time.time()) + self.__rng.randbytes(self.__profile.payload_size - SEND_TIME.size)
+        timestamp = self.__now_us()
+        if self.__framing == Framing.BINARY:
+            frame = frame_encode(
+                PACKET_HEADER.pack(FrameType.PACKET, timestamp, 8 + len(data), dev_id, pkt_id, ack_id) + data
+            )
+        else:
+            fields = (dev_id, struct.pack("<H", pkt_id), struct.pack("<H", ack_id), struct.pack("<Q", timestamp), data)
+            frame = b"[" + b"".join(base64.urlsafe_b64encode(field) + b"\0" for field in fields) + b"]"
+
+        self.__counters["rx_ok"] += 1
+        if self.__write(frame):
+            self.stats["sent"] += 1
+        # Reported after the acknowledgement has been transmitted
+        if ack_id != 0xFFFF:
+            self.__send_event(FrameType.DELIVERED, DELIVERED.pack(dev_id, ack_id))
+
+    def __process_command(self, cmd_str: bytes):
+        try:
+            cmd, arg = decode_command(cmd_str)
+        except FrameError as e:
+            logging.warning(f"Emulator: invalid command: {e}")
+            self.__counters["downlink_frame_errors"] += 1
+            return
+
+        if cmd == Command.SET_FRAMING and len(arg) == 1 and arg[0] in (Framing.TEXT, Framing.BINARY):
+            # The confirmation is always sent as text event after a delimiter
+            self.__write(b"\0" + encode_event(FrameType.FRAMING, arg))
+            self.__framing = Framing(arg[0])
+            self.__rx_consumed = 0
+            self.__send_credit()
+        elif cmd == Command.SET_RADIO and len(arg) == RADIO_CONFIG.size:
+            self.__send_event(FrameType.RADIO, struct.pack("<b", 0) + arg)
+        elif cmd == Command.TIME_SYNC and len(arg) == 4:
+            self.__send_event(FrameType.TIME, TIME.pack(struct.unpack("<I", arg)[0], self.__now_us()))
+        else:
+            logging.warning(f"Emulator: invalid command {cmd} ({len(arg)})")
+
+    def __process_downlink(self, pkt_str: bytes):
+        fields = pkt_str.split(b"\0")
+        try:
+            dev_id = base64.urlsafe_b64decode(fields[0])
+            pkt_id = struct.unpack("<H", base64.urlsafe_b64decode(fields[1]))[0]
+            ttl_s, flags = 0, DownlinkFlag.NONE
+            if len(fields) > 3 and fields[3]:
+                ttl_s, flags = DOWNLINK_OPTS.unpack(base64.urlsafe_b64decode(fields[3]))
+        except Exception as e:
+            logging.warning(f"Emulator: invalid downlink packet: {e}")
+            self.__counters["downlink_frame_errors"] += 1
+            return
+
+        self.stats["downlink_received"] += 1
+        queue = self.__downlinks.get(dev_id)
+        replaced = list()
+        if queue is not None and flags & DownlinkFlag.REPLACE:
+            replaced = [entry for entry in queue if entry[2] & DownlinkFlag.REPLACE]
+            queue[:] = [entry for entry in queue if not entry[2] & DownlinkFlag.REPLACE]
+        if queue is None or len(queue) >= MAX_PKTS_PER_DEVICE:
+            self.__counters["downlink_rejected"] += 1
+            err = -errno.ENOSPC if queue is not None else -errno.ENODEV
+            self.__send_event(FrameType.REJECTED, REJECTED.pack(dev_id, pkt_id, err))
+            return
+
+        entry = (pkt_id, time.monotonic() + (ttl_s or MSG_DEFAULT_TTL_S), flags)
+        if flags & DownlinkFlag.PRIORITY:
+            queue.insert(0, entry)
+        else:
+            queue.append(entry)
+        for replaced_id, _, _ in replaced:
+            self.__send_event(FrameType.DISCARDED, DISCARDED.pack(dev_id, replaced_id, DiscardReason.REPLACED))
+
+    def __sweep(self):
+        """Discards expired downlink packets."""
+        now = time.monotonic()
+        for dev_id, queue in self.__downlinks.items():
+            for pkt_id, _, _ in [entry for entry in queue if entry[1] <= now]:
+                self.__send_event(FrameType.DISCARDED, DISCARDED.pack(dev_id, pkt_id, DiscardReason.EXPIRED))
+            queue[:] = [entry for entry in queue if entry[1] > now]
+
+    def __send_credit(self):
+        self.__rx_consumed_reported = self.__rx_consumed
+        self.__send_event(FrameType.CREDIT, CREDIT.pack(self.__rx_consumed & 0xFFFFFFFF, RX_WINDOW))
+
+    def __consume(self, n: int):
+        del self.__rx_buf[:n]
+        self.__rx_consumed += n
+
+    def __on_readable(self):
+        try:
+            self.__rx_buf += os.read(self.__master, 4096)
+        except BlockingIOError:
+            return
+
+        # Process all complete command and packet frames
+        while True:
+            start = next((idx for idx, byte in enumerate(self.__rx_buf) if byte in b"[{"), -1)
+            if start < 0:
+                self.__consume(len(self.__rx_buf))
+                break
+            end = self.__rx_buf.find(b"}" if self.__rx_buf[start] == ord("{") else b"]", start)
+            if end < 0:
+                self.__consume(start)
+                break
+            is_command = self.__rx_buf[start] == ord("{")
+            frame = bytes(self.__rx_buf[start + 1 : end])
+            # Consumed before processing like on the transceiver, so that SET_FRAMING restarts the count after itself
+            self.__consume(end + 1)
+            if is_command:
+                self.__process_command(frame)
+            else:
+                self.__process_downlink(frame)
+
+        if self.__rx_consumed - self.__rx_consumed_reported >= CREDIT_REPORT_THRESHOLD:
+            self.__send_credit()
+
+    async def __stats_loop(self):
+        while True:
+            await asyncio.sleep(STATS_INTERVAL)
+            self.__sweep()
+            uptime_ms = int((time.monotonic() - self.__t0) * 1e3) & 0xFFFFFFFF
+            self.__send_event(FrameType.STATS, STATS.pack(uptime_ms, *self.__counters.values()))
+            self.__send_credit()
+
+    async def __traffic_loop(self):
+        # Next burst of every device
+        schedule = [(self.__profile.next_burst(self.__rng), idx) for idx in range(self.__profile.n_devices)]
+        heapq.heapify(schedule)
+        start = time.monotonic()
+        while True:
+            t_next, dev_idx = schedule[0]
+            delay = start + t_next - time.monotonic()
+            if delay > 0:
+                await asyncio.sleep(delay)
+            for _ in range(self.__profile.burst):
+                self.__send_packet(dev_idx)
+            heapq.heapreplace(schedule, (t_next + self.__profile.next_burst(self.__rng), dev_idx))
+
+    async def run(self):
+        """Generates traffic and serves the host until cancelled."""
+        loop = asyncio.get_running_loop()
+        loop.add_reader(self.__master, self.__on_readable)
+        try:
+            await asyncio.gather(self.__stats_loop(), self.__traffic_loop())
+        finally:
+            loop.remove_reader(self.__master)
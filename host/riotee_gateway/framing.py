@@ -0,0 +1,307 @@
+"""Framing of the data exchanged with the gateway transceiver over USB CDC ACM."""
+import base64
+import binascii
+import struct
+from enum import IntEnum
+from enum import IntFlag
+
+
+class Framing(IntEnum):
+    """Framing used by the transceiver for data sent to the host."""
+
+    # Base64 encoded fields separated by \0 and enclosed in brackets
+    TEXT = 0
+    # COBS encoded raw structures with length and CRC trailer, delimited by \0
+    BINARY = 1
+
+
+class FrameType(IntEnum):
+    PACKET = 0x01
+    FRAMING = 0x02
+    REJECTED = 0x03
+    STATS = 0x04
+    RADIO = 0x05
+    TIME = 0x06
+    DELIVERED = 0x07
+    DISCARDED = 0x08
+    CREDIT = 0x09
+
+
+class Command(IntEnum):
+    SET_FRAMING = 0x01
+    SET_RADIO = 0x02
+    TIME_SYNC = 0x03
+
+
+class Rate(IntEnum):
+    """Radio data rate of the transceiver."""
+
+    BLE_1MBIT = 0
+    BLE_2MBIT = 1
+
+
+class DownlinkFlag(IntFlag):
+    """Options for packets queued on the transceiver."""
+
+    NONE = 0x00
+    # Send before the other packets queued for the device
+    PRIORITY = 0x01
+    # Supersedes the packets queued for the device that also have this flag
+    REPLACE = 0x02
+
+
+class DiscardReason(IntEnum):
+    """Why the transceiver discarded a queued packet."""
+
+    EXPIRED = 0
+    REPLACED = 1
+
+
+class FrameError(Exception):
+    pass
+
+
+# Length of the frame excluding the trailer and CRC over frame and length
+TRAILER = struct.Struct("<HH")
+# Frame type, dongle timestamp in microseconds, packet length, device ID, packet ID, acknowledgement ID
+PACKET_HEADER = struct.Struct("<BQB4sHH")
+# Device ID, packet ID and negative error code of a packet the transceiver could not queue
+REJECTED = struct.Struct("<4sHb")
+# Device ID and packet ID of a packet the transceiver sent to the device
+DELIVERED = struct.Struct("<4sH")
+# Device ID, packet ID and DiscardReason of a packet the transceiver discarded
+DISCARDED = struct.Struct("<4sHB")
+# Bytes received by the transceiver since the last SET_FRAMING command and size of its receive window
+CREDIT = struct.Struct("<IH")
+# Time to live in seconds and DownlinkFlag of a packet sent to the transceiver
+DOWNLINK_OPTS = struct.Struct("<HB")
+# Names of the pipeline counters reported by the transceiver in the order they are sent
+STATS_COUNTERS = (
+    "rx_ok",
+    "rx_crc_error",
+    "rx_dropped",
+    "tx_ring_dropped",
+    "downlink_dropped",
+    "downlink_rejected",
+    "delivered_dropped",
+    "downlink_frame_errors",
+)
+# Transceiver uptime in milliseconds followed by the pipeline counters
+STATS = struct.Struct(f"<I{len(STATS_COUNTERS)}I")
+# Token of the time synchronization request and transceiver time in microseconds
+TIME = struct.Struct("<IQ")
+# Maximum number of channels in the listening schedule of the transceiver
+RADIO_MAX_CHANNELS = 8
+# Data rate, time spent on each channel in milliseconds, number of channels and channels as offsets from 2400 MHz
+RADIO_CONFIG = struct.Struct(f"<BHB{RADIO_MAX_CHANNELS}s")
+# Negative error code of the last configuration command followed by the active configuration
+RADIO = struct.Struct(f"<bBHB{RADIO_MAX_CHANNELS}s")
+
+
+# Data without a frame delimiter beyond this size is considered corrupted
+MAX_FRAME_SIZE = 1024
+
+
+class FrameParser(object):
+    """Incremental parser for the data stream received from the transceiver.
+
+    Received data is accumulated in one buffer and all complete frames are extracted at once. Data between frames,
+    frames that fail to decode and text frames that are interrupted by the start of another frame are skipped and
+    counted, so the parser resynchronizes on the next intact frame. The FRAMING confirmation is always sent as text
+    event, so the parser recognizes it in both framings and switches to the confirmed framing right after it.
+    """
+
+    def __init__(self, framing: Framing = Framing.TEXT):
+        self.framing = framing
+        self.__buf = bytearray()
+        self.stats = {"frame_errors": 0, "skipped_bytes": 0}
+
+    def feed(self, data: bytes):
+        self.__buf += data
+
+    def __error(self, n_skipped: int):
+        self.stats["frame_errors"] += 1
+        self.stats["skipped_bytes"] += n_skipped
+
+    def __text_event(self, evt_str: bytes, frames: list):
+        evt_type, body = decode_event(evt_str)
+        frames.append((Framing.TEXT, evt_type, body))
+        if evt_type == FrameType.FRAMING and len(body) == 1 and body[0] in tuple(Framing):
+            self.framing = Framing(body[0])
+
+    def __parse_binary(self, buf: bytearray, pos: int, frames: list) -> int:
+        end = buf.find(b"\0", pos)
+        if end < 0:
+            return -1
+
+        # A text event that confirms a change of framing is not followed by a delimiter. Its first field is the base64
+        # encoded type of 4 characters. A binary frame that starts with the same byte is a COBS block of 122 non-zero
+        # bytes, so the parser never looks beyond the delimiter of a valid binary frame.
+        if buf[pos] == ord("{") and end - pos == 5:
+            if (body_end := buf.find(b"\0", end + 1)) < 0 or body_end + 1 == len(buf):
+                return -1
+            if buf[body_end + 1] == ord("}"):
+                try:
+                    self.__text_event(bytes(buf[pos + 1 : body_end + 1]), frames)
+                    return body_end + 2
+                except FrameError:
+                    pass
+
+        if end > pos:
+            try:
+                with memoryview(buf) as view:
+                    raw = frame_decode(view[pos:end])
+                if raw[0] == FrameType.PACKET:
+                    frames.append((Framing.BINARY, FrameType.PACKET, raw))
+                else:
+                    frames.append((Framing.BINARY, raw[0], bytes(raw[1:])))
+            except FrameError:
+                self.__error(end - pos)
+        return end + 1
+
+    def __parse_text(self, buf: bytearray, pos: int, frames: list) -> int:
+        start_pkt = buf.find(b"[", pos)
+        start_evt = buf.find(b"{", pos)
+        if start_pkt < 0 and start_evt < 0:
+            self.stats["skipped_bytes"] += len(buf) - pos
+            return len(buf)
+        start = start_evt if start_pkt < 0 or 0 <= start_evt < start_pkt else start_pkt
+        self.stats["skipped_bytes"] += start - pos
+
+        end = buf.find(b"]" if start == start_pkt else b"}", start + 1)
+        if end < 0:
+            return -1 if start == pos else start
+        # Resynchronize on the start of another frame within a frame that lost its end
+        restarts = [idx for idx in (buf.find(b"[", start + 1, end), buf.find(b"{", start + 1, end)) if idx >= 0]
+        if restarts:
+            self.__error(min(restarts) - start)
+            return min(restarts)
+
+        try:
+            if start == start_pkt:
+                frames.append((Framing.TEXT, FrameType.PACKET, bytes(buf[start + 1 : end])))
+            else:
+                self.__text_event(bytes(buf[start + 1 : end]), frames)
+        except FrameError:
+            self.__error(end + 1 - start)
+        return end + 1
+
+    def parse(self) -> list:
+        """Returns framing, type and content of all complete frames received so far.
+
+        The content of events is the decoded body. The content of binary packets is the decoded frame starting with the
+        type and the content of text packets is the string between the brackets.
+        """
+        frames = list()
+        buf = self.__buf
+        pos = 0
+        while pos < len(buf):
+            if self.framing == Framing.BINARY:
+                next_pos = self.__parse_binary(buf, pos, frames)
+            else:
+                next_pos = self.__parse_text(buf, pos, frames)
+            if next_pos < 0:
+                break
+            pos = next_pos
+
+        if len(buf) - pos > MAX_FRAME_SIZE:
+            self.__error(len(buf) - pos)
+            pos = len(buf)
+        # Compact once per call instead of once per frame
+        del buf[:pos]
+        return frames
+
+
+def encode_radio_config(rate: Rate, channels, dwell_ms: int = 0) -> bytes:
+    if not 0 < len(channels) <= RADIO_MAX_CHANNELS:
+        raise ValueError(f"between 1 and {RADIO_MAX_CHANNELS} channels required")
+    return RADIO_CONFIG.pack(rate, dwell_ms, len(channels), bytes(channels))
+
+
+def decode_radio_event(body: bytes):
+    """Returns the result code and the active configuration reported by the transceiver."""
+    err, rate, dwell_ms, n_channels, channels = RADIO.unpack(body)
+    return err, {"rate": Rate(rate).name, "dwell_ms": dwell_ms, "channels": list(channels[:n_channels])}
+
+
+def cobs_encode(data: bytes) -> bytearray:
+    """Applies consistent overhead byte stuffing to data. The \0 delimiter is not appended."""
+    out = bytearray([0])
+    code_idx = 0
+    for byte in data:
+        if byte != 0:
+            out.append(byte)
+        if byte == 0 or len(out) - code_idx == 0xFF:
+            out[code_idx] = len(out) - code_idx
+            code_idx = len(out)
+            out.append(0)
+    out[code_idx] = len(out) - code_idx
+    return out
+
+
+def cobs_decode(data: bytes) -> bytearray:
+    """Reverses consistent overhead byte stuffing of data without the \0 delimiter."""
+    out = bytearray()
+    idx = 0
+    while idx < len(data):
+        code = data[idx]
+        end = idx + code
+        if code == 0 or end > len(data):
+            raise FrameError("invalid COBS block")
+        out += data[idx + 1 : end]
+        idx = end
+        # Blocks of maximum length and the last block have no implicit zero
+        if code < 0xFF and idx < len(data):
+            out.append(0)
+    return out
+
+
+def frame_decode(data: bytes) -> bytearray:
+    """Decodes a binary frame without the \0 delimiter and returns it without trailer."""
+    raw = cobs_decode(data)
+    if len(raw) < 1 + TRAILER.size:
+        raise FrameError("frame too short")
+    length, crc = TRAILER.unpack_from(raw, len(raw) - TRAILER.size)
+    if length != len(raw) - TRAILER.size:
+        raise FrameError("length mismatch")
+    if crc != binascii.crc_hqx(raw[:-2], 0xFFFF):
+        raise FrameError("CRC mismatch")
+    del raw[-TRAILER.size :]
+    return raw
+
+
+def frame_encode(raw: bytes) -> bytes:
+    """Appends the trailer to a raw frame and returns it as \0-delimited COBS frame like the transceiver does."""
+    raw = bytes(raw) + struct.pack("<H", len(raw))
+    raw += struct.pack("<H", binascii.crc_hqx(raw, 0xFFFF))
+    return bytes(cobs_encode(raw)) + b"\0"
+
+
+def encode_event(evt_type: FrameType, body: bytes) -> bytes:
+    """Returns a text event frame like the transceiver sends it."""
+    return b"{" + base64.urlsafe_b64encode(bytes([evt_type])) + b"\0" + base64.urlsafe_b64encode(body) + b"\0}"
+
+
+def decode_command(cmd_str: bytes):
+    """Decodes the contents of a command frame between the curly brackets into command and argument."""
+    return decode_event(cmd_str)
+
+
+def encode_command(cmd: Command, arg: bytes = b"") -> bytes:
+    """Returns a command frame ready to be sent to the gateway transceiver."""
+    return b"{" + base64.urlsafe_b64encode(bytes([cmd])) + b"\0" + base64.urlsafe_b64encode(arg) + b"\0}"
+
+
+def decode_event(evt_str: bytes):
+    """Decodes the contents of a text event frame between the curly brackets into type and body."""
+    fields = evt_str.split(b"\0")
+    if len(fields) != 3 or fields[2]:
+        raise FrameError("malformed event")
+    try:
+        evt_type = base64.urlsafe_b64decode(fields[0])
+        body = base64.urlsafe_b64decode(fields[1])
+    except binascii.Error as e:
+        raise FrameError(f"invalid base64 in event: {e}")
+    if len(evt_type) != 1:
+        raise FrameError("malformed event type")
+    return evt_type[0], body
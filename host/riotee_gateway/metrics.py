@@ -0,0 +1,184 @@
+"""Metrics of the gateway in the Prometheus text exposition format."""
+import asyncio
+import bisect
+import math
+import time
+from typing import Callable
+from typing import Iterable
+from typing import List
+
+CONTENT_TYPE = "text/plain; version=0.0.4; charset=utf-8"
+
+# Bucket bounds in seconds for durations of request handlers and similar operations
+LATENCY_BUCKETS = (0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0)
+# Bucket bounds in seconds for operations that normally take microseconds
+FAST_BUCKETS = (1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1)
+
+
+def format_value(value) -> str:
+    if isinstance(value, int):
+        return str(value)
+    if math.isinf(value):
+        return "+Inf" if value > 0 else "-Inf"
+    if math.isnan(value):
+        return "NaN"
+    return repr(float(value))
+
+
+def format_labels(names, values) -> str:
+    if not names:
+        return ""
+    escaped = (str(v).replace("\\", "\\\\").replace('"', '\\"').replace("\n", "\\n") for v in values)
+    return "{" + ",".join(f'{name}="{value}"' for name, value in zip(names, escaped)) + "}"
+
+
+class CounterValue(object):
+    __slots__ = ("value",)
+
+    def __init__(self):
+        self.value = 0
+
+    def inc(self, n=1):
+        self.value += n
+
+    def samples(self, name: str):
+        yield name, (), (), self.value
+
+
+class GaugeValue(CounterValue):
+    __slots__ = ()
+
+    def set(self, value):
+        self.value = value
+
+    def dec(self, n=1):
+        self.value -= n
+
+
+class HistogramValue(object):
+    __slots__ = ("bounds", "counts", "sum")
+
+    def __init__(self, bounds):
+        self.bounds = bounds
+        # One count per bucket and one for values above the largest bound, not cumulative
+        self.counts = [0] * (len(bounds) + 1)
+        self.sum = 0.0
+
+    def observe(self, value: float):
+        self.counts[bisect.bisect_left(self.bounds, value)] += 1
+        self.sum += value
+
+    def samples(self, name: str):
+        total = 0
+        for bound, count in zip(self.bounds, self.counts):
+            total += count
+            yield name + "_bucket", ("le",), (format_value(float(bound)),), total
+        total += self.counts[-1]
+        yield name + "_bucket", ("le",), ("+Inf",), total
+        yield name + "_sum", (), (), self.sum
+        yield name + "_count", (), (), total
+
+
+class MetricFamily(object):
+    """Samples with the same name that are distinguished by the values of their labels.
+
+    Families without labels can be used directly like their single value, e.g., counter.inc().
+    """
+
+    KINDS = {"counter": CounterValue, "gauge": GaugeValue}
+
+    def __init__(self, kind: str, name: str, documentation: str, labels: Iterable[str] = (), buckets=LATENCY_BUCKETS):
+        self.kind = kind
+        self.name = name
+        self.documentation = documentation
+        self.label_names = tuple(labels)
+        self.__buckets = tuple(sorted(buckets))
+        # Maps the label values to the value
+        self.__values = dict()
+        if not self.label_names:
+            self.labels()
+
+    def __new_value(self):
+        if self.kind == "histogram":
+            return HistogramValue(self.__buckets)
+        return MetricFamily.KINDS[self.kind]()
+
+    def labels(self, *values):
+        """Returns the value for the label values, creating it on first use."""
+        key = tuple(str(v) for v in values)
+        if len(key) != len(self.label_names):
+            raise ValueError(f"{self.name} expects labels {self.label_names}")
+        if (value := self.__values.get(key)) is None:
+            value = self.__values[key] = self.__new_value()
+        return value
+
+    def __getattr__(self, attr):
+        # Delegates inc(), set(), observe() etc. of families without labels
+        if attr.startswith("_"):
+            raise AttributeError(attr)
+        return getattr(self.labels(), attr)
+
+    def render(self) -> List[str]:
+        lines = [f"# HELP {self.name} {self.documentation}", f"# TYPE {self.name} {self.kind}"]
+        for key, value in self.__values.items():
+            for name, extra_names, extra_values, sample in value.samples(self.name):
+                labels = format_labels(self.label_names + extra_names, key + extra_values)
+                lines.append(f"{name}{labels} {format_value(sample)}")
+        return lines
+
+
+class Registry(object):
+    """Metrics that are updated where the events happen and collectors that read existing state when scraped."""
+
+    def __init__(self):
+        self.__families = dict()
+        self.__collectors = list()
+
+    def __register(self, family: MetricFamily) -> MetricFamily:
+        if family.name in self.__families:
+            raise ValueError(f"Metric {family.name} is already registered")
+        self.__families[family.name] = family
+        return family
+
+    def counter(self, name: str, documentation: str, labels: Iterable[str] = ()) -> MetricFamily:
+        return self.__register(MetricFamily("counter", name, documentation, labels))
+
+    def gauge(self, name: str, documentation: str, labels: Iterable[str] = ()) -> MetricFamily:
+        return self.__register(MetricFamily("gauge", name, documentation, labels))
+
+    def histogram(
+        self, name: str, documentation: str, labels: Iterable[str] = (), buckets=LATENCY_BUCKETS
+    ) -> MetricFamily:
+        return self.__register(MetricFamily("histogram", name, documentation, labels, buckets))
+
+    def add_collector(self, collector: Callable[[], Iterable[MetricFamily]]):
+        """Adds a function that returns families with the current values of existing state on every scrape."""
+        self.__collectors.append(collector)
+
+    def render(self) -> bytes:
+        lines = list()
+        for family in self.__families.values():
+            lines += family.render()
+        for collector in self.__collectors:
+            for family in collector():
+                lines += family.render()
+        return ("\n".join(lines) + "\n").encode()
+
+
+REGISTRY = Registry()
+
+
+def snapshot(kind: str, name: str, documentation: str, labels: Iterable[str], values: dict) -> MetricFamily:
+    """Creates a counter or gauge family for a collector from a dict that maps label values to values."""
+    family = MetricFamily(kind, name, documentation, labels)
+    for label_values, value in values.items():
+        family.labels(*label_values).value = value
+    return family
+
+
+async def loop_lag_loop(histogram: MetricFamily, interval: float = 0.5):
+    """Measures how much later than scheduled the event loop wakes up a sleeping task."""
+    while True:
+        t_start = time.perf_counter()
+        await asyncio.sleep(interval)
+        histogram.observe(max(0.0, time.perf_counter() - t_start - interval))
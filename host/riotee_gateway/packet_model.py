@@ -4,6 +4,31 @@ from pydantic import Field
 from datetime import datetime
 import numpy as np
 import base64
+import re
+import struct
+from typing import List
+
+from riotee_gateway.framing import DOWNLINK_OPTS
+from riotee_gateway.framing import DownlinkFlag
+from riotee_gateway.framing import FrameError
+from riotee_gateway.framing import PACKET_HEADER
+from riotee_gateway.framing import RADIO_MAX_CHANNELS
+from riotee_gateway.framing import Rate
+
+
+# Maximum payload size of a packet
+PKT_DATA_MAX_SIZE = 247
+# Canonical url-safe base64 with padding. Anything else could end a field of the text framing early.
+URLSAFE_BASE64 = re.compile(rb"(?:[A-Za-z0-9_-]{4})*(?:[A-Za-z0-9_-]{2}==|[A-Za-z0-9_-]{3}=)?")
+
+
+def urlsafe_b64decode_strict(val: bytes) -> bytes:
+    """Decodes url-safe base64 and raises ValueError for characters outside the alphabet or misplaced padding."""
+    if isinstance(val, str):
+        val = val.encode()
+    if URLSAFE_BASE64.fullmatch(val) is None:
+        raise ValueError("invalid url-safe base64")
+    return base64.urlsafe_b64decode(val)
 
 
 class PacketBase(BaseModel):
@@ -12,14 +37,14 @@ class PacketBase(BaseModel):
 
     @validator("data", check_fields=False)
     def is_data_base64(cls, val):
-        val_bytes = base64.urlsafe_b64decode(val)
-        if len(val_bytes) > 247:
+        val_bytes = urlsafe_b64decode_strict(val)
+        if len(val_bytes) > PKT_DATA_MAX_SIZE:
             raise ValueError("data too long")
         return val
 
     @validator("dev_id", check_fields=False)
     def is_device_id(cls, val):
-        val_bytes = base64.urlsafe_b64decode(val)
+        val_bytes = urlsafe_b64decode_strict(val)
         if len(val_bytes) != 4:
             raise ValueError("device id has wrong size")
         return val
@@ -41,9 +66,48 @@ class PacketBase(BaseModel):
             return val
 
 
+class RadioConfig(BaseModel):
+    """Data rate and channel schedule of the transceivers."""
+
+    rate: Rate = Rate.BLE_1MBIT
+    # Offsets from 2400 MHz in MHz
+    channels: List[int] = [76]
+    # Time spent listening on each channel if there is more than one
+    dwell_ms: int = 0
+
+    @validator("channels")
+    def channels_valid(cls, val):
+        if not 0 < len(val) <= RADIO_MAX_CHANNELS:
+            raise ValueError(f"between 1 and {RADIO_MAX_CHANNELS} channels required")
+        if any(ch < 0 or ch > 100 for ch in val):
+            raise ValueError("channel outside range 0-100")
+        return val
+
+    @validator("dwell_ms")
+    def dwell_ms_is_uint16(cls, val, values):
+        if val < 0 or val >= 2**16:
+            raise ValueError("outside range for uint16")
+        if val == 0 and len(values.get("channels", [])) > 1:
+            raise ValueError("dwell time required for more than one channel")
+        return val
+
+
 class PacketApiSend(PacketBase):
     """Packet sent to the Gateway server via API to be forwarded to a device."""
 
+    # Seconds after which the packet is discarded if the device did not pick it up. Defaults to the server's limit.
+    ttl: int | None = None
+    # Send before the other packets queued for the device
+    priority: bool = False
+    # Supersede queued packets for the device that were also sent with replace, e.g. an outdated configuration
+    replace: bool = False
+
+    @validator("ttl")
+    def ttl_is_uint16(cls, val):
+        if val is not None and (val <= 0 or val >= 2**16):
+            raise ValueError("outside range 1-65535")
+        return val
+
     @classmethod
     def from_binary(cls, data: bytes, pkt_id: np.int16 = None):
         data_enc = base64.urlsafe_b64encode(data)
@@ -54,17 +118,27 @@ class PacketTransceiverSend(PacketBase):
     """Packet sent to the transceiver via USB CDC ACM."""
 
     dev_id: bytes
+    # Time to live in seconds or 0 for the default of the transceiver
+    ttl: int = 0
+    flags: DownlinkFlag = DownlinkFlag.NONE
 
     @classmethod
     def from_PacketApiSend(cls, pkt: PacketApiSend, dev_id: bytes):
-        return cls(pkt_id=pkt.pkt_id, data=pkt.data, dev_id=dev_id)
+        flags = DownlinkFlag.NONE
+        if pkt.priority:
+            flags |= DownlinkFlag.PRIORITY
+        if pkt.replace:
+            flags |= DownlinkFlag.REPLACE
+        return cls(pkt_id=pkt.pkt_id, data=pkt.data, dev_id=dev_id, ttl=pkt.ttl or 0, flags=flags)
 
     def to_uart(self):
         """Returns a string ready to be sent to the gateway transceiver."""
         dev_id_enc = str(self.dev_id, "utf-8")
         data_enc = str(self.data, "utf-8")
         pkt_id_enc = str(base64.urlsafe_b64encode(np.uint16(self.pkt_id)), "utf-8")
-        return bytes(f"[{dev_id_enc}\0{pkt_id_enc}\0{data_enc}\0]", encoding="utf-8")
+        # Older transceivers ignore the options
+        opts_enc = str(base64.urlsafe_b64encode(DOWNLINK_OPTS.pack(self.ttl, self.flags)), "utf-8")
+        return bytes(f"[{dev_id_enc}\0{pkt_id_enc}\0{data_enc}\0{opts_enc}\0]", encoding="utf-8")
 
 
 class PacketApiReceive(PacketBase):
@@ -74,7 +148,8 @@ class PacketApiReceive(PacketBase):
     pkt_id: int
     ack_id: int
     timestamp: datetime
-    dongle_timestamp: int  # np.uint64
+    # Microseconds since boot of the transceiver, captured when the radio matched the address of the packet
+    dongle_timestamp_us: int  # np.uint64
 
     @staticmethod
     def str_extract(pkt_str: bytes):
@@ -108,12 +183,19 @@ class PacketApiReceive(PacketBase):
         ack_id, term_idx = cls.base64_to_bin(pkt_str, np.uint16)
         pkt_str = pkt_str[term_idx + 1 :]
 
-        dongle_timestamp, term_idx = cls.base64_to_bin(pkt_str, np.uint64)
+        dongle_timestamp_us, term_idx = cls.base64_to_bin(pkt_str, np.uint64)
         pkt_str = pkt_str[term_idx + 1 :]
 
         data, _ = cls.str_extract(pkt_str)
 
-        return cls(dev_id=dev_id, pkt_id=pkt_id, ack_id=ack_id, data=data, timestamp=timestamp, dongle_timestamp=dongle_timestamp)
+        return cls(
+            dev_id=dev_id,
+            pkt_id=pkt_id,
+            ack_id=ack_id,
+            data=data,
+            timestamp=timestamp,
+            dongle_timestamp_us=dongle_timestamp_us,
+        )
 
     @classmethod
     def from_json(cls, json_dict: dict):
@@ -123,6 +205,7 @@ class PacketApiReceive(PacketBase):
             ack_id=json_dict["ack_id"],
             data=json_dict["data"],
             timestamp=json_dict["timestamp"],
+            dongle_timestamp_us=json_dict["dongle_timestamp_us"],
         )
 
     def to_json(self):
@@ -131,3 +214,91 @@ class PacketApiReceive(PacketBase):
         json_dict["data"] = str(self.data, encoding="utf-8")
         json_dict["timestamp"] = str(self.timestamp)
         return json_dict
+
+
+class PacketRecord(object):
+    """Received packet in its raw form with a lazily built and cached JSON encoding.
+
+    Received packets are validated once when they are created from the data of the transceiver. They are converted to
+    the JSON representation of PacketApiReceive without going through pydantic, because this happens for every packet
+    that is retrieved via the API.
+    """
+
+    __slots__ = ("dev_id", "pkt_id", "ack_id", "dongle_timestamp_us", "timestamp", "data", "_json")
+
+    def __init__(
+        self, dev_id: bytes, pkt_id: int, ack_id: int, dongle_timestamp_us: int, timestamp: float, data: bytes
+    ):
+        if len(dev_id) != 4:
+            raise ValueError("device id has wrong size")
+        if len(data) > PKT_DATA_MAX_SIZE:
+            raise ValueError("data too long")
+        self.dev_id = dev_id
+        self.pkt_id = pkt_id
+        self.ack_id = ack_id
+        self.dongle_timestamp_us = dongle_timestamp_us
+        self.timestamp = timestamp
+        self.data = data
+        self._json = None
+
+    @staticmethod
+    def __field(pkt_str: bytes, start: int):
+        """Returns the base64 encoded field that starts at start and the start of the next field."""
+        end = pkt_str.find(b"\0", start)
+        if end < 0:
+            raise ValueError("Could not find terminating character")
+        return pkt_str[start:end], end + 1
+
+    @classmethod
+    def from_uart(cls, pkt_str: bytes, timestamp: float):
+        """Creates a record from a text frame received from the gateway transceiver."""
+        dev_id, start = cls.__field(pkt_str, 0)
+        pkt_id, start = cls.__field(pkt_str, start)
+        ack_id, start = cls.__field(pkt_str, start)
+        dongle_timestamp_us, start = cls.__field(pkt_str, start)
+        data, _ = cls.__field(pkt_str, start)
+
+        return cls(
+            base64.urlsafe_b64decode(dev_id),
+            struct.unpack("<H", base64.urlsafe_b64decode(pkt_id))[0],
+            struct.unpack("<H", base64.urlsafe_b64decode(ack_id))[0],
+            struct.unpack("<Q", base64.urlsafe_b64decode(dongle_timestamp_us))[0],
+            timestamp,
+            base64.urlsafe_b64decode(data),
+        )
+
+    @classmethod
+    def from_frame(cls, frame: bytes, timestamp: float):
+        """Creates a record from a decoded binary frame received from the gateway transceiver."""
+        if len(frame) < PACKET_HEADER.size:
+            raise FrameError(f"packet frame of {len(frame)} bytes is shorter than its header")
+        _, dongle_timestamp_us, length, dev_id, pkt_id, ack_id = PACKET_HEADER.unpack_from(frame)
+        # The packet length includes the dev_id, pkt_id and ack_id fields
+        if PACKET_HEADER.size + length - 8 != len(frame):
+            raise FrameError(f"packet length {length} does not match frame of {len(frame)} bytes")
+        data = bytes(frame[PACKET_HEADER.size :])
+        return cls(dev_id, pkt_id, ack_id, dongle_timestamp_us, timestamp, data)
+
+    def to_json(self) -> bytes:
+        """Returns the JSON encoding of the corresponding PacketApiReceive."""
+        if self._json is None:
+            dev_id = str(base64.urlsafe_b64encode(self.dev_id), "utf-8")
+            data = str(base64.urlsafe_b64encode(self.data), "utf-8")
+            timestamp = datetime.fromtimestamp(self.timestamp).isoformat()
+            # Base64 strings and ISO timestamps never need escaping
+            self._json = bytes(
+                f'{{"data":"{data}","pkt_id":{self.pkt_id},"dev_id":"{dev_id}","ack_id":{self.ack_id},'
+                f'"timestamp":"{timestamp}","dongle_timestamp_us":{self.dongle_timestamp_us}}}',
+                "utf-8",
+            )
+        return self._json
+
+    def to_api(self) -> PacketApiReceive:
+        return PacketApiReceive(
+            dev_id=base64.urlsafe_b64encode(self.dev_id),
+            pkt_id=self.pkt_id,
+            ack_id=self.ack_id,
+            data=base64.urlsafe_b64encode(self.data),
+            timestamp=datetime.fromtimestamp(self.timestamp),
+            dongle_timestamp_us=self.dongle_timestamp_us,
+        )
@@ -0,0 +1,135 @@
+"""Aggregation of several transceivers that cover the same set of devices."""
+import asyncio
+import logging
+import math
+import time
+from collections import OrderedDict
+from typing import List
+
+from riotee_gateway.delivery import DeliveryTracker
+from riotee_gateway.packet_model import PacketRecord
+from riotee_gateway.packet_model import PacketTransceiverSend
+from riotee_gateway.transceiver import Transceiver
+from riotee_gateway.transceiver import TransceiverBusy
+
+
+class Deduplicator(object):
+    """Detects packets that were already received within a time window, e.g., by another transceiver."""
+
+    def __init__(self, window: float = 2.0):
+        self.__window = window
+        # Maps (dev_id, pkt_id) to the time it was first seen, oldest first
+        self.__seen = OrderedDict()
+
+    def __len__(self):
+        return len(self.__seen)
+
+    def is_duplicate(self, dev_id: bytes, pkt_id: int, now: float = None) -> bool:
+        if now is None:
+            now = time.monotonic()
+
+        # Packet IDs wrap around, so entries must expire
+        while self.__seen:
+            key, first_seen = next(iter(self.__seen.items()))
+            if now - first_seen < self.__window:
+                break
+            del self.__seen[key]
+
+        key = (dev_id, pkt_id)
+        if key in self.__seen:
+            return True
+        self.__seen[key] = now
+        return False
+
+
+class TransceiverPool(object):
+    """Merges the packets received by several transceivers and routes downlink packets between them.
+
+    Packets of a device that are heard by more than one transceiver are only passed on once. Downlink packets are sent
+    through the transceiver that most recently passed on a packet from the device, because the device is most likely in
+    its range and listens for the downlink right after its own transmission.
+    """
+
+    def __init__(
+        self, tcvs: List[Transceiver], dedup_window: float = 2.0, radio: dict = None, delivery_timeout: float = 60.0
+    ):
+        if not tcvs:
+            raise ValueError("at least one transceiver is required")
+        self.tcvs = tcvs
+        # Packets are discarded by the transceivers when they are reported as expired
+        self.__max_ttl = min(math.ceil(delivery_timeout), 2**16 - 1)
+        self.delivery = DeliveryTracker(delivery_timeout)
+        for tcv in tcvs:
+            tcv.delivery = self.delivery
+        # Arguments for Transceiver.set_radio() applied to all transceivers on startup
+        self.__radio = radio
+        self.__dedup = Deduplicator(dedup_window)
+        self.__last_heard = dict()
+        self.__stats = {"duplicates": 0}
+
+    async def __aenter__(self):
+        for tcv in self.tcvs:
+            await tcv.__aenter__()
+            if self.__radio is not None:
+                tcv.set_radio(**self.__radio)
+        return self
+
+    async def __aexit__(self, *args):
+        for tcv in self.tcvs:
+            await tcv.__aexit__(*args)
+
+    def accept(self, tcv: Transceiver, pkt: PacketRecord) -> bool:
+        """Returns True if the packet received by the transceiver is not a duplicate."""
+        if self.__dedup.is_duplicate(pkt.dev_id, pkt.pkt_id):
+            self.__stats["duplicates"] += 1
+            return False
+        self.__last_heard[pkt.dev_id] = tcv
+        return True
+
+    async def reconnect(self, tcv: Transceiver, backoff: float = 1.0, max_backoff: float = 30.0):
+        """Reopens a disconnected transceiver, retrying with exponential backoff until it succeeds.
+
+        The transceiver is closed right away, so downlink packets are routed through the others in the meantime.
+        """
+        await tcv.close()
+        while True:
+            await asyncio.sleep(backoff)
+            try:
+                await tcv.reopen()
+                if self.__radio is not None:
+                    tcv.set_radio(**self.__radio)
+                logging.info(f"Reconnected to transceiver at {tcv.port}")
+                return
+            except OSError as e:
+                logging.warning(f"Could not reopen transceiver at {tcv.port}: {e}")
+                await tcv.close()
+                backoff = min(2 * backoff, max_backoff)
+
+    def route(self, dev_id: bytes) -> Transceiver:
+        """Returns the transceiver that should send downlink packets to the device."""
+        tcv = self.__last_heard.get(dev_id)
+        if tcv is not None and tcv.connected:
+            return tcv
+        return next((tcv for tcv in self.tcvs if tcv.connected), self.tcvs[0])
+
+    def send_packet(self, dev_id: bytes, pkt: PacketTransceiverSend) -> bool:
+        """Sends the packet unless the same packet is still waiting for delivery. Returns True if it was sent.
+
+        Raises TransceiverBusy if the transceiver cannot take more packets at the moment or none is connected.
+        """
+        tcv = self.route(dev_id)
+        if tcv.tx_full or not tcv.connected:
+            raise TransceiverBusy()
+        if not self.delivery.track(dev_id, pkt.pkt_id):
+            return False
+        pkt.ttl = min(pkt.ttl or self.__max_ttl, self.__max_ttl)
+        tcv.send_packet(pkt)
+        return True
+
+    @property
+    def stats(self) -> dict:
+        return {
+            "transceivers": {tcv.port: tcv.stats for tcv in self.tcvs},
+            "pool": dict(self.__stats),
+            "delivery": self.delivery.stats,
+        }
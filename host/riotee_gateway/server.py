@@ -1,44 +1,402 @@
 import asyncio
+import base64
+import binascii
 from fastapi import FastAPI
+from fastapi import Header
 from fastapi import HTTPException
+from fastapi import Query
+from fastapi import Request
+from fastapi.responses import Response
+from fastapi.responses import StreamingResponse
+import io
+import itertools
+import json
 import logging
-
+import math
+import numpy as np
+import os
+import time
+from typing import List
+
+from riotee_gateway.framing import STATS_COUNTERS
+from riotee_gateway.metrics import CONTENT_TYPE
+from riotee_gateway.metrics import REGISTRY
+from riotee_gateway.metrics import loop_lag_loop
+from riotee_gateway.metrics import snapshot
 from riotee_gateway.packet_model import *
+from riotee_gateway.pool import TransceiverPool
+from riotee_gateway.store import PacketStore
+from riotee_gateway.stream import PacketBroadcaster
 from riotee_gateway.transceiver import Transceiver
+from riotee_gateway.transceiver import TransceiverBusy
+
+# Interval for removing packets that fall out of the retention limits
+RETENTION_INTERVAL = 60.0
+# Interval for sending comments on idle streams, so that clients and proxies do not time out
+KEEPALIVE_INTERVAL = 15.0
+# Pause after an error in the receive loop, so that a persistent error does not keep the server busy
+RECEIVE_ERROR_BACKOFF = 1.0
+# Longest time a request may wait for the delivery of a downlink packet
+MAX_DELIVERY_WAIT = 60.0
+# Largest page of a time range query
+MAX_QUERY_LIMIT = 100000
+# Packets serialized at once in streamed responses
+STREAM_CHUNK_SIZE = 256
+
+PACKETS_STORED = REGISTRY.counter("riotee_packets_stored_total", "Packets received and stored", ["port"])
+INGEST_LATENCY = REGISTRY.histogram(
+    "riotee_ingest_latency_seconds",
+    "Time from the reception of a packet by the radio until it is stored, accurate once the clocks are synchronized",
+)
+DOWNLINK_REQUESTS = REGISTRY.counter(
+    "riotee_downlink_requests_total", "Downlink packets submitted over the API by result", ["result"]
+)
+HTTP_REQUEST_DURATION = REGISTRY.histogram(
+    "riotee_http_request_duration_seconds",
+    "Time until the response of a request starts, by route and status",
+    ["method", "route", "status"],
+)
+LOOP_LAG = REGISTRY.histogram("riotee_event_loop_lag_seconds", "Delay of the event loop in waking up a sleeping task")
+
+
+class DeviceQueue(object):
+    """View of the packets of one device in the store in the order they were received."""
+
+    def __init__(self, store: PacketStore, dev_id: bytes):
+        self.__store = store
+        self.__dev_id = dev_id
+
+    @staticmethod
+    def to_packet(record) -> PacketRecord:
+        _, dev_id, pkt_id, ack_id, dongle_timestamp_us, timestamp, data = record
+        return PacketRecord(dev_id, pkt_id, ack_id, dongle_timestamp_us, timestamp, data)
+
+    def __len__(self):
+        return self.__store.count(self.__dev_id)
+
+    def __getitem__(self, index: int) -> PacketRecord:
+        return self.to_packet(self.__store.get(self.__dev_id, index))
+
+    def __delitem__(self, index: int):
+        self.__store.delete(self.__dev_id, index)
+
+    def __iter__(self):
+        for record in self.__store.iter(self.__dev_id):
+            yield self.to_packet(record)
 
 
 class PacketDatabase(object):
     """Stores received packets until they are retrieved over the API."""
 
-    def __init__(self) -> None:
-        self.__db = dict()
+    def __init__(self, store: PacketStore) -> None:
+        self.__store = store
 
-    def add(self, pkt: PacketApiReceive):
+    @staticmethod
+    def decode_dev_id(dev_id) -> bytes:
         try:
-            self.__db[pkt.dev_id].append(pkt)
-        except KeyError:
-            self.__db[pkt.dev_id] = [pkt]
+            return base64.urlsafe_b64decode(dev_id)
+        except (binascii.Error, ValueError):
+            raise KeyError(dev_id)
+
+    def add(self, pkt: PacketRecord) -> int:
+        """Stores the packet and returns its sequence number."""
+        return self.__store.append(pkt.dev_id, pkt.pkt_id, pkt.ack_id, pkt.dongle_timestamp_us, pkt.timestamp, pkt.data)
+
+    def add_many(self, pkts: List[PacketRecord]) -> List[int]:
+        """Stores the packets and returns their sequence numbers."""
+        append = self.__store.append
+        return [
+            append(pkt.dev_id, pkt.pkt_id, pkt.ack_id, pkt.dongle_timestamp_us, pkt.timestamp, pkt.data) for pkt in pkts
+        ]
+
+    def usage(self):
+        """Iterates over device ID, number of packets and bytes stored for all devices."""
+        for dev_id in self.__store.devices():
+            yield dev_id, self.__store.count(dev_id), self.__store.count_bytes(dev_id)
+
+    @property
+    def n_segments(self) -> int:
+        return self.__store.n_segments
 
     def reset(self, dev_id):
-        self.__db[dev_id] = list()
+        self.__store.truncate(self.decode_dev_id(dev_id))
 
     def get_devices(self):
-        return list(self.__db.keys())
+        return [base64.urlsafe_b64encode(dev_id) for dev_id in self.__store.devices()]
+
+    @property
+    def last_seq(self) -> int:
+        return self.__store.last_seq
+
+    def replay(self, dev_ids: set = None, since: int = -1):
+        """Iterates over sequence number and packet of all stored packets newer than since."""
+        for record in self.__store.iter_all(dev_ids, since):
+            yield record[0], DeviceQueue.to_packet(record)
+
+    def query(self, dev_id=None, since: float = None, until: float = None, after=None):
+        """Returns an iterator over position and packet of the packets of the device or all devices in the time range.
+
+        Packets are ordered by their timestamps, i.e., the time of reception by the radio of the transceiver. A position
+        is the timestamp and sequence number of a packet and continues the query behind the packet if passed as after.
+        """
+        since = -math.inf if since is None else since
+        until = math.inf if until is None else until
+        if dev_id is None:
+            records = self.__store.iter_range_all(None, since, until, after)
+        else:
+            dev_id_raw = self.decode_dev_id(dev_id)
+            # Raises KeyError for unknown devices
+            self.__store.count(dev_id_raw)
+            records = self.__store.iter_range(dev_id_raw, since, until, after)
+        return ((pos, DeviceQueue.to_packet(record)) for pos, record in records)
+
+    def prepare_export(self, dev_id=None, since: float = None, until: float = None):
+        """Returns a function that returns the packets of the device or all devices in the time range as numpy columns.
+
+        The function may run in another thread.
+        """
+        since = -math.inf if since is None else since
+        until = math.inf if until is None else until
+        dev_ids = None if dev_id is None else [self.decode_dev_id(dev_id)]
+        if dev_ids is not None:
+            # Raises KeyError for unknown devices
+            self.__store.count(*dev_ids)
+        return self.__store.prepare_export(dev_ids, since, until)
+
+    def drain(self, dev_id=None, max_pkts: int = None, ack: int = None):
+        """Deletes the packets up to and including ack and returns the oldest remaining packets.
+
+        Packets of all devices are returned in the order they were received if no device is specified.
+        """
+        dev_ids = None if dev_id is None else {self.decode_dev_id(dev_id)}
+        if dev_ids is not None:
+            # Raises KeyError for unknown devices
+            self.__store.count(*dev_ids)
+        for dev_id_raw in self.__store.devices() if dev_ids is None else dev_ids:
+            if ack is not None:
+                self.__store.ack(dev_id_raw, ack)
+
+        pkts = list()
+        cursor = ack
+        for seq, pkt in self.replay(dev_ids):
+            if max_pkts is not None and len(pkts) >= max_pkts:
+                break
+            pkts.append(pkt)
+            cursor = seq
+        return cursor, pkts
+
+    def enforce_retention(self):
+        self.__store.enforce_retention()
+
+    def close(self):
+        self.__store.close()
+
+    def __getitem__(self, dev_id) -> DeviceQueue:
+        dev_id_raw = self.decode_dev_id(dev_id)
+        # Raises KeyError for unknown devices
+        self.__store.count(dev_id_raw)
+        return DeviceQueue(self.__store, dev_id_raw)
+
+
+async def receive_loop(tcv: Transceiver, pool: TransceiverPool, db: PacketDatabase, broadcaster: PacketBroadcaster):
+    """Stores and publishes the packets received by the transceiver in batches.
+
+    If the serial port fails, e.g., because the transceiver was unplugged, the pool reopens it. Other errors are logged
+    and never end the loop, so a single bad packet or a temporary failure does not stop ingestion.
+    """
+    stored = PACKETS_STORED.labels(tcv.port)
+    while True:
+        try:
+            pkts = await tcv.read_packets()
+        except OSError as e:
+            logging.warning(f"Transceiver at {tcv.port} disconnected: {e}")
+            await pool.reconnect(tcv)
+            continue
+        except Exception:
+            logging.exception(f"Error receiving packets from {tcv.port}")
+            await asyncio.sleep(RECEIVE_ERROR_BACKOFF)
+            continue
+        try:
+            pkts = [pkt for pkt in pkts if pool.accept(tcv, pkt)]
+            seqs = db.add_many(pkts)
+            stored.inc(len(pkts))
+            now = time.time()
+            for pkt in pkts:
+                INGEST_LATENCY.observe(now - pkt.timestamp)
+            if len(broadcaster):
+                for seq, pkt in zip(seqs, pkts):
+                    broadcaster.publish(seq, pkt.dev_id, str(pkt.to_json(), "utf-8"))
+        except Exception:
+            logging.exception(f"Error storing packets from {tcv.port}")
+            await asyncio.sleep(RECEIVE_ERROR_BACKOFF)
+            continue
+        if logging.getLogger().isEnabledFor(logging.DEBUG):
+            for pkt in pkts:
+                dev_id = str(base64.urlsafe_b64encode(pkt.dev_id), "utf-8")
+                logging.debug(f"Got packet from {dev_id} with ID {pkt.pkt_id} @{pkt.timestamp}")
+
+
+async def retention_loop(db: PacketDatabase):
+    while True:
+        await asyncio.sleep(RETENTION_INTERVAL)
+        db.enforce_retention()
 
-    def __getitem__(self, dev_id):
-        return self.__db[dev_id]
 
+def json_response(body: bytes) -> Response:
+    return Response(content=body, media_type="application/json")
 
-async def receive_loop(tcv: Transceiver, db: PacketDatabase):
-    while True:
-        pkt = await tcv.read_packet()
-        db.add(pkt)
-        logging.debug(f"Got packet from {pkt.dev_id} with ID {pkt.pkt_id} @{pkt.timestamp}")
+
+def json_packets(pkts) -> bytes:
+    """Joins the cached JSON encodings of the packets into a JSON array."""
+    return b"[" + b",".join(pkt.to_json() for pkt in pkts) + b"]"
+
+
+def json_batch(cursor: int, pkts) -> bytes:
+    return b'{"cursor":' + (b"null" if cursor is None else b"%d" % cursor) + b',"packets":' + json_packets(pkts) + b"}"
+
+
+def encode_cursor(pos) -> str:
+    timestamp, seq = pos
+    return f"{timestamp!r}:{seq}"
+
+
+def decode_cursor(cursor: str):
+    """Returns the position encoded in the cursor. Raises ValueError if the cursor is malformed."""
+    timestamp, _, seq = cursor.rpartition(":")
+    return float(timestamp), int(seq)
+
+
+async def stream_json_packets(pkts):
+    """Streams the cached JSON encodings of the packets as a JSON array without holding all of them in memory."""
+    yield b"["
+    pkts = iter(pkts)
+    separator = b""
+    while chunk := list(itertools.islice(pkts, STREAM_CHUNK_SIZE)):
+        yield separator + b",".join(pkt.to_json() for pkt in chunk)
+        separator = b","
+    yield b"]"
+
+
+async def stream_json_page(items, limit: int, cursor: str):
+    """Streams up to limit packets from an iterator over position and packet together with the cursor of the last one.
+
+    The flag more tells the client that the page is full and more packets may follow behind the cursor.
+    """
+    page = {"cursor": cursor, "more": False}
+
+    def pkts():
+        for n, (pos, pkt) in enumerate(items):
+            if n == limit:
+                page["more"] = True
+                return
+            page["cursor"] = encode_cursor(pos)
+            yield pkt
+
+    yield b'{"packets":'
+    async for chunk in stream_json_packets(pkts()):
+        yield chunk
+    yield b',"cursor":%s,"more":%s}' % (json.dumps(page["cursor"]).encode(), b"true" if page["more"] else b"false")
 
 
-tcv: Transceiver = None
-db = PacketDatabase()
+def query_response(dev_id, since: float, until: float, limit: int, after_cursor: str) -> StreamingResponse:
+    try:
+        after = None if after_cursor is None else decode_cursor(after_cursor)
+    except ValueError:
+        raise HTTPException(status_code=422, detail="Invalid cursor")
+    try:
+        items = db.query(dev_id, since, until, after)
+    except KeyError:
+        raise HTTPException(status_code=404, detail="Device not found")
+    return StreamingResponse(stream_json_page(items, limit, after_cursor), media_type="application/json")
+
+
+def encode_npz(columns: dict) -> bytes:
+    f = io.BytesIO()
+    np.savez(f, **columns)
+    return f.getvalue()
+
+
+async def export_response(dev_id, since: float, until: float) -> Response:
+    try:
+        export = db.prepare_export(dev_id, since, until)
+    except KeyError:
+        raise HTTPException(status_code=404, detail="Device not found")
+    # Only the snapshot of the index is taken in the event loop, copying and encoding the columns can take seconds. The
+    # copy must run even if the request is cancelled, because the store keeps its segments until it is done.
+    content = await asyncio.shield(asyncio.to_thread(lambda: encode_npz(export())))
+    return Response(content=content, media_type="application/octet-stream")
+
+
+def sse_event(event: str, seq: int, data: str) -> str:
+    return f"event: {event}\nid: {seq}\ndata: {data}\n\n"
+
+
+def rss_bytes() -> int:
+    """Returns the resident memory of the server process or None if not available on the platform."""
+    try:
+        with open("/proc/self/statm") as f:
+            return int(f.read().split()[1]) * os.sysconf("SC_PAGE_SIZE")
+    except OSError:
+        return None
+
+
+def collect_metrics():
+    """Current state of store, transceivers and downlink packets for the metrics endpoint."""
+    usage = [(str(base64.urlsafe_b64encode(dev_id), "utf-8"), n, n_bytes) for dev_id, n, n_bytes in db.usage()]
+    packets = {(dev_id,): n for dev_id, n, _ in usage}
+    yield snapshot("gauge", "riotee_store_packets", "Packets stored per device", ["device"], packets)
+    n_bytes = {(dev_id,): n for dev_id, _, n in usage}
+    yield snapshot("gauge", "riotee_store_bytes", "Bytes stored per device", ["device"], n_bytes)
+    yield snapshot("gauge", "riotee_store_segments", "Segment files of the store", [], {(): db.n_segments})
+    yield snapshot("gauge", "riotee_stream_subscribers", "Clients subscribed to the stream", [], {(): len(broadcaster)})
+    if (rss := rss_bytes()) is not None:
+        yield snapshot("gauge", "riotee_process_resident_memory_bytes", "Resident memory of the server", [], {(): rss})
+
+    stats = pool.stats
+    # Pipeline counters reported by the transceivers since they started
+    tcvs = stats["transceivers"]
+    dongles = {(port,): s["transceiver"] for port, s in tcvs.items() if s["transceiver"] is not None}
+    uptimes = {key: s["uptime_ms"] / 1e3 for key, s in dongles.items()}
+    yield snapshot("gauge", "riotee_transceiver_uptime_seconds", "Uptime of the transceiver", ["port"], uptimes)
+    for name in STATS_COUNTERS:
+        counts = {key: s[name] for key, s in dongles.items()}
+        yield snapshot("counter", f"riotee_transceiver_{name}_total", f"Transceiver counter {name}", ["port"], counts)
+
+    # Host side of the serial link
+    hosts = {(port,): s["host"] for port, s in tcvs.items()}
+    queues = {key: s["tx_queue"] for key, s in hosts.items()}
+    yield snapshot("gauge", "riotee_serial_tx_queue", "Frames waiting to be written", ["port"], queues)
+    for name in ("packets", "decode_errors", "frame_errors", "skipped_bytes", "tx_bytes", "tx_rejected"):
+        counts = {key: s[name] for key, s in hosts.items()}
+        yield snapshot("counter", f"riotee_serial_{name}_total", f"Serial link counter {name}", ["port"], counts)
+    drifts = {(port,): s["clock"]["drift_ppm"] for port, s in tcvs.items() if s["clock"] is not None}
+    yield snapshot("gauge", "riotee_clock_drift_ppm", "Drift of the transceiver clock", ["port"], drifts)
+
+    duplicates = {(): stats["pool"]["duplicates"]}
+    yield snapshot("counter", "riotee_packets_duplicate_total", "Packets received more than once", [], duplicates)
+    delivery = stats["delivery"]
+    pending = {(): delivery["pending"]}
+    yield snapshot("gauge", "riotee_downlink_pending", "Downlink packets waiting for delivery", [], pending)
+    finished = {(status,): delivery[status] for status in ("delivered", "rejected", "expired", "superseded")}
+    yield snapshot("counter", "riotee_downlink_finished_total", "Downlink packets by status", ["status"], finished)
+
+
+pool: TransceiverPool = None
+db: PacketDatabase = None
+broadcaster = PacketBroadcaster()
 app = FastAPI()
+REGISTRY.add_collector(collect_metrics)
+
+
+@app.middleware("http")
+async def measure_request(request: Request, call_next):
+    t_start = time.perf_counter()
+    response = await call_next(request)
+    # Labelled with the route template rather than the path, so that device IDs do not create new label values
+    route = request.scope.get("route")
+    route = "unmatched" if route is None else route.path
+    HTTP_REQUEST_DURATION.labels(request.method, route, response.status_code).observe(time.perf_counter() - t_start)
+    return response
 
 
 @app.get("/")
@@ -46,11 +404,77 @@ async def get_root():
     return "Welcome to the Riotee Gateway!"
 
 
+@app.get("/stats")
+async def get_stats():
+    """Packet counters of the transceiver pipeline stages and the server."""
+    n_pkts = 0
+    for dev_id in db.get_devices():
+        n_pkts += len(db[dev_id])
+    return {**pool.stats, "server": {"devices": len(db.get_devices()), "packets": n_pkts, "rss_bytes": rss_bytes()}}
+
+
+@app.get("/metrics")
+async def get_metrics():
+    """Metrics in the Prometheus text format."""
+    return Response(content=REGISTRY.render(), media_type=CONTENT_TYPE)
+
+
 @app.get("/devices")
 async def get_devices():
     return db.get_devices()
 
 
+@app.get("/stream")
+async def stream_packets(
+    device: List[str] = Query(None), cursor: int = None, last_event_id: int | None = Header(None)
+):
+    """Streams received packets as server-sent events.
+
+    Only packets from the given devices are sent if any are specified. If a cursor is given, all stored packets with a
+    larger sequence number are sent first. The Last-Event-ID header of a reconnecting client has the same effect.
+    """
+    try:
+        dev_ids = None if device is None else {db.decode_dev_id(dev_id) for dev_id in device}
+    except KeyError:
+        raise HTTPException(status_code=422, detail="Invalid device ID")
+    if cursor is None:
+        cursor = last_event_id
+
+    async def events():
+        # Subscribe before replaying, so that no packet is missed in between
+        sub = broadcaster.subscribe(dev_ids)
+        try:
+            last = db.last_seq
+            yield sse_event("cursor", last if cursor is None else cursor, "")
+            if cursor is not None:
+                replay_end = last
+                last = min(cursor, replay_end)
+                for seq, pkt in db.replay(dev_ids, cursor):
+                    if seq > replay_end:
+                        break
+                    yield sse_event("packet", seq, str(pkt.to_json(), "utf-8"))
+                    last = seq
+
+            while True:
+                if sub.overflowed:
+                    yield sse_event("overflow", last, "")
+                    return
+                try:
+                    seq, pkt_json = await asyncio.wait_for(sub.queue.get(), KEEPALIVE_INTERVAL)
+                except asyncio.TimeoutError:
+                    yield ": keepalive\n\n"
+                    continue
+                # Already sent during the replay
+                if seq <= last:
+                    continue
+                yield sse_event("packet", seq, pkt_json)
+                last = seq
+        finally:
+            broadcaster.unsubscribe(sub)
+
+    return StreamingResponse(events(), media_type="text/event-stream", headers={"Cache-Control": "no-cache"})
+
+
 @app.get("/in/all/size")
 async def get_all_queue_size():
     n_tot = 0
@@ -61,10 +485,8 @@ async def get_all_queue_size():
 
 @app.get("/in/all/all")
 async def get_all_packets():
-    pkts = list()
-    for dev_id in db.get_devices():
-        pkts += db[dev_id]
-    return pkts
+    pkts = itertools.chain.from_iterable(db[dev_id] for dev_id in db.get_devices())
+    return StreamingResponse(stream_json_packets(pkts), media_type="application/json")
 
 
 @app.delete("/in/all/all")
@@ -74,6 +496,53 @@ async def delete_all_packets():
         db.reset(dev_id)
 
 
+@app.post("/in/all/drain")
+async def drain_all_packets(max: int = Query(100, gt=0), ack: int = None):
+    """Acknowledges the previous batch and returns the next batch of packets from all devices.
+
+    Packets are only deleted once the cursor of the batch is passed back as ack, so a batch that was lost on the way to
+    the client is returned again by the next call.
+    """
+    cursor, pkts = db.drain(None, max, ack)
+    return json_response(json_batch(cursor, pkts))
+
+
+@app.get("/in/all/export")
+async def export_all_packets(since: float = None, until: float = None):
+    """Returns the packets of all devices received between since and until as columns in the NumPy .npz format.
+
+    The columns are dev_id, pkt_id, ack_id, dongle_timestamp_us, timestamp and the concatenated payloads in data, where
+    the payload of packet i spans from data_offsets[i] to data_offsets[i + 1]. Packets are ordered by their timestamps.
+    """
+    return await export_response(None, since, until)
+
+
+@app.get("/in/all")
+async def query_all_packets(
+    since: float = None,
+    until: float = None,
+    limit: int = Query(1000, gt=0, le=MAX_QUERY_LIMIT),
+    after_cursor: str = None,
+):
+    """Streams a page of the packets of all devices received between since and until ordered by their timestamps.
+
+    Times are in seconds since the epoch. Pass the cursor of a page as after_cursor to get the next page.
+    """
+    return query_response(None, since, until, limit, after_cursor)
+
+
+@app.get("/in/{dev_id}")
+async def query_dev_packets(
+    dev_id: bytes,
+    since: float = None,
+    until: float = None,
+    limit: int = Query(1000, gt=0, le=MAX_QUERY_LIMIT),
+    after_cursor: str = None,
+):
+    """Streams a page of the packets of the device received between since and until ordered by their timestamps."""
+    return query_response(dev_id, since, until, limit, after_cursor)
+
+
 @app.get("/in/{dev_id}/size")
 async def get_queue_size(dev_id: bytes):
     try:
@@ -85,9 +554,10 @@ async def get_queue_size(dev_id: bytes):
 @app.get("/in/{dev_id}/all")
 async def get_all_dev_packets(dev_id: bytes):
     try:
-        return db[dev_id]
+        pkts = db[dev_id]
     except KeyError:
         raise HTTPException(status_code=404, detail="Device not found")
+    return StreamingResponse(stream_json_packets(pkts), media_type="application/json")
 
 
 @app.delete("/in/{dev_id}/all")
@@ -98,10 +568,26 @@ async def delete_all_devpackets(dev_id: bytes):
         raise HTTPException(status_code=404, detail="Device not found")
 
 
+@app.post("/in/{dev_id}/drain")
+async def drain_dev_packets(dev_id: bytes, max: int = Query(100, gt=0), ack: int = None):
+    """Acknowledges the previous batch and returns the next batch of packets from the device."""
+    try:
+        cursor, pkts = db.drain(dev_id, max, ack)
+    except KeyError:
+        raise HTTPException(status_code=404, detail="Device not found")
+    return json_response(json_batch(cursor, pkts))
+
+
+@app.get("/in/{dev_id}/export")
+async def export_dev_packets(dev_id: bytes, since: float = None, until: float = None):
+    """Returns the packets of the device received between since and until as columns in the NumPy .npz format."""
+    return await export_response(dev_id, since, until)
+
+
 @app.get("/in/{dev_id}/{index}")
 async def get_packet(dev_id: bytes, index: int):
     try:
-        return db[dev_id][index]
+        return json_response(db[dev_id][index].to_json())
     except KeyError:
         raise HTTPException(status_code=404, detail="Device not found")
     except IndexError:
@@ -120,17 +606,54 @@ async def delete_packet(dev_id: bytes, index: int):
 
 @app.post("/out/{dev_id}")
 async def post_packet(dev_id: bytes, packet: PacketApiSend):
+    """Queues the packet on the transceiver. A packet with the same ID that is still pending is not queued again."""
+    try:
+        dev_id_raw = db.decode_dev_id(dev_id)
+    except KeyError:
+        raise HTTPException(status_code=422, detail="Invalid device ID")
     pkt_tcv = PacketTransceiverSend.from_PacketApiSend(packet, dev_id)
-    tcv.send_packet(pkt_tcv)
+    try:
+        sent = pool.send_packet(dev_id_raw, pkt_tcv)
+    except TransceiverBusy:
+        DOWNLINK_REQUESTS.labels("busy").inc()
+        raise HTTPException(status_code=503, detail="Transceiver busy", headers={"Retry-After": "1"})
+    DOWNLINK_REQUESTS.labels("queued" if sent else "suppressed").inc()
     return packet
 
 
+@app.get("/out/{dev_id}/{pkt_id}")
+async def get_delivery(dev_id: bytes, pkt_id: int, wait: float = Query(0.0, ge=0.0, le=MAX_DELIVERY_WAIT)):
+    """Delivery status of a downlink packet. Waits up to wait seconds while the packet is pending."""
+    try:
+        dev_id_raw = db.decode_dev_id(dev_id)
+        delivery = await pool.delivery.wait(dev_id_raw, pkt_id, wait)
+    except KeyError:
+        raise HTTPException(status_code=404, detail="Packet not found")
+    return delivery.to_dict()
+
+
+@app.put("/radio")
+async def put_radio(config: RadioConfig, port: str = None):
+    """Changes data rate and channel schedule of all transceivers or the one at the serial port."""
+    tcvs = [tcv for tcv in pool.tcvs if port is None or tcv.port == port]
+    if not tcvs:
+        raise HTTPException(status_code=404, detail="Transceiver not found")
+    for tcv in tcvs:
+        tcv.set_radio(config.rate, config.channels, config.dwell_ms)
+    return config
+
+
 @app.on_event("startup")
 async def startup_event():
-    await tcv.__aenter__()
-    asyncio.create_task(receive_loop(tcv, db))
+    await pool.__aenter__()
+    for tcv in pool.tcvs:
+        asyncio.create_task(receive_loop(tcv, pool, db, broadcaster))
+        asyncio.create_task(tcv.clock_sync_loop())
+    asyncio.create_task(retention_loop(db))
+    asyncio.create_task(loop_lag_loop(LOOP_LAG))
 
 
 @app.on_event("shutdown")
-def shutdown_event():
-    tcv.__exit__()
+async def shutdown_event():
+    await pool.__aexit__()
+    db.close()
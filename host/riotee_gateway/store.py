@@ -0,0 +1,595 @@
+"""Append-only, memory-mapped storage for received packets."""
+import bisect
+import heapq
+import logging
+import math
+import mmap
+import struct
+import threading
+import time
+import zlib
+from array import array
+from enum import IntEnum
+from pathlib import Path
+
+import numpy as np
+
+
+class RecordType(IntEnum):
+    PACKET = 1
+    # Deletes the packet with the sequence number of the record
+    DELETE = 2
+    # Deletes all packets of the device up to and including the sequence number of the record
+    TRUNCATE = 3
+
+
+# Record size including CRC, record type, sequence number, device ID, packet ID, ack ID, dongle timestamp and host
+# timestamp
+RECORD_HEADER = struct.Struct("<HBQ4sHHqd")
+# CRC32 over header and data
+RECORD_CRC = struct.Struct("<I")
+# Maximum payload of a record
+RECORD_DATA_MAX_SIZE = 255
+# Header, maximum payload and CRC
+RECORD_MAX_SIZE = RECORD_HEADER.size + RECORD_DATA_MAX_SIZE + RECORD_CRC.size
+# RECORD_HEADER for reading the headers of many records at once
+RECORD_HEADER_DTYPE = np.dtype(
+    [
+        ("size", "<u2"),
+        ("type", "u1"),
+        ("seq", "<u8"),
+        ("dev_id", "<u4"),
+        ("pkt_id", "<u2"),
+        ("ack_id", "<u2"),
+        ("dongle_timestamp_us", "<i8"),
+        ("timestamp", "<f8"),
+    ]
+)
+# Records copied at once when exporting, limits the size of the temporary arrays
+EXPORT_CHUNK_SIZE = 4096
+
+
+# Location of a deleted entry in the index of a device
+DELETED_LOC = 2**64 - 1
+# Deleted entries in the middle of the index of a device before it is compacted
+MAX_TOMBSTONES = 256
+
+
+def encode_loc(seg_no: int, offset: int) -> int:
+    return (seg_no << 32) | offset
+
+
+def decode_loc(loc: int):
+    return loc >> 32, loc & 0xFFFFFFFF
+
+
+def copy_ranges(
+    dst: np.ndarray, dst_starts: np.ndarray, src: np.ndarray, src_starts: np.ndarray, lengths: np.ndarray, width: int
+):
+    """Copies the ranges of the lengths from the starts in src to the starts in dst. No range is longer than width.
+
+    The ranges are gathered in chunks as rows of a sliding window of the width over src and packed with a mask, so there
+    is no index per byte. Consecutive ranges that continue each other in dst are stored with a single slice.
+    """
+    # Ranges too close to the end of src for a full window are copied one by one
+    fits = src_starts + width <= len(src)
+    for i in np.flatnonzero(~fits):
+        dst[dst_starts[i] : dst_starts[i] + lengths[i]] = src[src_starts[i] : src_starts[i] + lengths[i]]
+    rows = np.flatnonzero(fits)
+    if len(rows) == 0:
+        return
+    rows = rows[np.argsort(dst_starts[rows], kind="stable")]
+
+    windows = np.lib.stride_tricks.sliding_window_view(src, width)
+    columns = np.arange(width)
+    for i in range(0, len(rows), EXPORT_CHUNK_SIZE):
+        chunk = rows[i : i + EXPORT_CHUNK_SIZE]
+        chunk_lengths = lengths[chunk]
+        packed = windows[src_starts[chunk]][columns < chunk_lengths[:, None]]
+        packed_starts = np.zeros(len(chunk) + 1, np.int64)
+        np.cumsum(chunk_lengths, out=packed_starts[1:])
+        starts = dst_starts[chunk]
+        ends = starts + chunk_lengths
+        bounds = np.concatenate(([0], np.flatnonzero(starts[1:] != ends[:-1]) + 1, [len(chunk)]))
+        for first, end in zip(bounds[:-1], bounds[1:]):
+            dst[starts[first] : ends[end - 1]] = packed[packed_starts[first] : packed_starts[end]]
+
+
+class Segment(object):
+    """A fixed-size file that records are appended to and read from via mmap."""
+
+    def __init__(self, path: Path, seg_no: int, size: int):
+        self.path = path
+        self.seg_no = seg_no
+        self.tail = 0
+        # Number of packets in the segment that have not been deleted
+        self.n_live = 0
+        # Host timestamp of the newest packet in the segment
+        self.newest = 0.0
+
+        self.__file = open(path, "r+b" if path.exists() else "w+b")
+        if self.__file.seek(0, 2) < size:
+            self.__file.truncate(size)
+        self.mm = mmap.mmap(self.__file.fileno(), size)
+
+    def append(self, record: bytes) -> int:
+        """Appends a record and returns its offset or None if the segment is full."""
+        if self.tail + len(record) > len(self.mm):
+            return None
+        offset = self.tail
+        self.mm[offset : offset + len(record)] = record
+        self.tail += len(record)
+        return offset
+
+    def read(self, offset: int):
+        """Returns the header fields and the payload of the record at offset."""
+        header = RECORD_HEADER.unpack_from(self.mm, offset)
+        data_start = offset + RECORD_HEADER.size
+        return header, self.mm[data_start : offset + header[0] - RECORD_CRC.size]
+
+    def scan(self):
+        """Iterates over all valid records from the start and sets the tail behind the last one."""
+        offset = 0
+        while offset + RECORD_HEADER.size + RECORD_CRC.size <= len(self.mm):
+            size = RECORD_HEADER.unpack_from(self.mm, offset)[0]
+            if size < RECORD_HEADER.size + RECORD_CRC.size or offset + size > len(self.mm):
+                break
+            crc_offset = offset + size - RECORD_CRC.size
+            if RECORD_CRC.unpack_from(self.mm, crc_offset)[0] != zlib.crc32(self.mm[offset:crc_offset]):
+                break
+            yield offset, *self.read(offset)
+            offset += size
+
+        self.tail = offset
+        # Clear a partially written record so that it cannot be mistaken for valid data later
+        end = min(offset + RECORD_MAX_SIZE, len(self.mm))
+        self.mm[offset:end] = bytes(end - offset)
+
+    def close(self):
+        self.mm.flush()
+        self.mm.close()
+        self.__file.close()
+
+
+class DeviceIndex(object):
+    """Index of the packets of one device in the order they were stored with O(1) access to head and tail.
+
+    Packets deleted from the middle are marked with DELETED_LOC instead of being removed from the arrays, so that a
+    deletion does not move the rest of the index. The marked entries are removed once there are MAX_TOMBSTONES of them.
+    """
+
+    __slots__ = ("seqs", "timestamps", "locs", "sizes", "head", "tombstones", "n_bytes")
+
+    def __init__(self):
+        self.seqs = array("Q")
+        # Host timestamps, kept sorted for range queries
+        self.timestamps = array("d")
+        self.locs = array("Q")
+        # Record sizes
+        self.sizes = array("H")
+        # Entries before head have been deleted
+        self.head = 0
+        # Positions of the deleted entries after head in ascending order
+        self.tombstones = list()
+        # Total size of the records of the entries after head
+        self.n_bytes = 0
+
+    def __len__(self):
+        return len(self.seqs) - self.head - len(self.tombstones)
+
+    def append(self, seq: int, timestamp: float, loc: int, size: int):
+        # A packet timestamped before its predecessor, e.g., after the clock synchronization corrected the offset of the
+        # transceiver, is indexed at the time of its predecessor
+        if self.timestamps and timestamp < self.timestamps[-1]:
+            timestamp = self.timestamps[-1]
+        self.seqs.append(seq)
+        self.timestamps.append(timestamp)
+        self.locs.append(loc)
+        self.sizes.append(size)
+        self.n_bytes += size
+
+    def position(self, index: int) -> int:
+        """Returns the position in the arrays of the entry with the index among the entries that are not deleted."""
+        pos = self.head + index
+        for tombstone in self.tombstones:
+            if tombstone > pos:
+                break
+            pos += 1
+        return pos
+
+    def count_before(self, pos: int) -> int:
+        """Returns the number of entries before the position in the arrays that are not deleted."""
+        return pos - self.head - bisect.bisect_left(self.tombstones, pos)
+
+    def next_live(self, pos: int) -> int:
+        """Returns the first position at or after pos that is not deleted."""
+        while pos < len(self.locs) and self.locs[pos] == DELETED_LOC:
+            pos += 1
+        return pos
+
+    def popleft(self, n: int = 1) -> list:
+        """Deletes the oldest n entries and returns their locations."""
+        end = self.position(n - 1) + 1
+        locs = [loc for loc in self.locs[self.head : end] if loc != DELETED_LOC]
+        # Deleted entries have a size of 0
+        self.n_bytes -= sum(self.sizes[self.head : end])
+        self.head = end
+        del self.tombstones[: bisect.bisect_left(self.tombstones, end)]
+        # Reclaim the space of deleted entries once they make up most of the arrays
+        if self.head > 1024 and self.head > len(self.seqs) // 2:
+            self.__compact()
+        return locs
+
+    def remove(self, index: int) -> int:
+        """Deletes the entry with the index and returns its location."""
+        pos = self.position(index)
+        loc = self.locs[pos]
+        self.n_bytes -= self.sizes[pos]
+        self.locs[pos] = DELETED_LOC
+        self.sizes[pos] = 0
+        bisect.insort(self.tombstones, pos)
+        if len(self.tombstones) > MAX_TOMBSTONES:
+            self.__compact()
+        return loc
+
+    def __compact(self):
+        """Removes the entries before head and the deleted entries from the arrays."""
+        bounds = [self.head - 1] + self.tombstones + [len(self.seqs)]
+        for name in ("seqs", "timestamps", "locs", "sizes"):
+            arr = getattr(self, name)
+            compacted = array(arr.typecode)
+            for start, end in zip(bounds, bounds[1:]):
+                compacted += arr[start + 1 : end]
+            setattr(self, name, compacted)
+        self.head = 0
+        self.tombstones = list()
+
+    def find(self, seq: int) -> int:
+        """Returns the index of the entry with the sequence number or -1."""
+        pos = bisect.bisect_left(self.seqs, seq, self.head)
+        if pos < len(self.seqs) and self.seqs[pos] == seq and self.locs[pos] != DELETED_LOC:
+            return self.count_before(pos)
+        return -1
+
+    def count_until(self, seq: int) -> int:
+        """Returns the number of entries with a sequence number up to and including seq."""
+        return self.count_before(bisect.bisect_right(self.seqs, seq, self.head))
+
+    def after(self, timestamp: float, seq: int) -> int:
+        """Returns the position in the arrays of the first entry after the timestamp and sequence number."""
+        lo = bisect.bisect_left(self.timestamps, timestamp, self.head)
+        hi = bisect.bisect_right(self.timestamps, timestamp, lo)
+        return bisect.bisect_right(self.seqs, seq, lo, hi)
+
+
+class PacketStore(object):
+    """Stores packets in append-only segment files keyed by device ID.
+
+    Packets are indexed per device in the order they were received, which is also the order of their timestamps.
+    Deletions are appended as records as well, so that the state can be recovered after a restart by replaying the
+    segments. Segments are removed from the oldest end once all of their packets are deleted or they fall out of the
+    retention limits.
+    """
+
+    def __init__(self, path: Path, segment_size: int = 16 * 1024 * 1024, max_age: float = None, max_bytes: int = None):
+        self.__path = Path(path)
+        self.__segment_size = segment_size
+        self.__max_age = max_age
+        self.__max_bytes = max_bytes
+        # Segments ordered from oldest to newest
+        self.__segments = dict()
+        self.__devices = dict()
+        self.__next_seq = 0
+        # Exports that copy from the segments in another thread. Segments are not removed while there are any.
+        self.__n_exports = 0
+        self.__exports_lock = threading.Lock()
+
+        self.__path.mkdir(parents=True, exist_ok=True)
+        self.__recover()
+
+    def __recover(self):
+        for seg_path in sorted(self.__path.glob("*.seg")):
+            seg = Segment(seg_path, int(seg_path.stem), self.__segment_size)
+            self.__segments[seg.seg_no] = seg
+            for offset, header, _ in seg.scan():
+                self.__replay(seg, offset, header)
+
+        n_pkts = sum(len(dev_idx) for dev_idx in self.__devices.values())
+        logging.info(f"Recovered {n_pkts} packets from {len(self.__segments)} segments in {self.__path}")
+
+        if not self.__segments:
+            self.__add_segment(0)
+        self.__reclaim()
+
+    def __replay(self, seg: Segment, offset: int, header):
+        size, rec_type, seq, dev_id, _, _, _, timestamp = header
+        self.__next_seq = max(self.__next_seq, seq + 1)
+        if rec_type == RecordType.PACKET:
+            index = self.__devices.setdefault(dev_id, DeviceIndex())
+            index.append(seq, timestamp, encode_loc(seg.seg_no, offset), size)
+            seg.n_live += 1
+            seg.newest = max(seg.newest, timestamp)
+        elif (dev_idx := self.__devices.get(dev_id)) is None:
+            return
+        elif rec_type == RecordType.DELETE:
+            if (index := dev_idx.find(seq)) >= 0:
+                self.__drop(dev_idx, index)
+        elif rec_type == RecordType.TRUNCATE:
+            self.__drop_head(dev_idx, dev_idx.count_until(seq))
+
+    def __add_segment(self, seg_no: int) -> Segment:
+        seg = Segment(self.__path / f"{seg_no:010d}.seg", seg_no, self.__segment_size)
+        self.__segments[seg_no] = seg
+        return seg
+
+    @property
+    def __active(self) -> Segment:
+        return self.__segments[next(reversed(self.__segments))]
+
+    def __append(
+        self, rec_type: RecordType, seq: int, dev_id: bytes, pkt_id=0, ack_id=0, dongle_ts=0, ts=0.0, data=b""
+    ):
+        size = RECORD_HEADER.size + len(data) + RECORD_CRC.size
+        record = RECORD_HEADER.pack(size, rec_type, seq, dev_id, pkt_id, ack_id, dongle_ts, ts) + data
+        record += RECORD_CRC.pack(zlib.crc32(record))
+
+        seg = self.__active
+        if (offset := seg.append(record)) is None:
+            seg = self.__add_segment(seg.seg_no + 1)
+            offset = seg.append(record)
+        return seg, offset, len(record)
+
+    def __drop(self, dev_idx: DeviceIndex, index: int):
+        self.__segments[decode_loc(dev_idx.remove(index))[0]].n_live -= 1
+
+    def __drop_head(self, dev_idx: DeviceIndex, n: int):
+        if n == 0:
+            return
+        for loc in dev_idx.popleft(n):
+            self.__segments[decode_loc(loc)[0]].n_live -= 1
+
+    def __remove_segment(self, seg: Segment):
+        """Removes the oldest segment together with all of its packets that are still in the index."""
+        for dev_idx in self.__devices.values():
+            n = 0
+            pos = dev_idx.next_live(dev_idx.head)
+            while pos < len(dev_idx.locs) and decode_loc(dev_idx.locs[pos])[0] == seg.seg_no:
+                n += 1
+                pos = dev_idx.next_live(pos + 1)
+            if n > 0:
+                dev_idx.popleft(n)
+        del self.__segments[seg.seg_no]
+        seg.close()
+        seg.path.unlink()
+        if not self.__segments:
+            self.__add_segment(seg.seg_no + 1)
+
+    def __reclaim(self):
+        """Removes the oldest segments as long as they do not contain any packets."""
+        if self.__n_exports > 0:
+            return
+        while len(self.__segments) > 1:
+            seg = self.__segments[next(iter(self.__segments))]
+            if seg.n_live > 0:
+                break
+            self.__remove_segment(seg)
+
+    def enforce_retention(self):
+        """Removes the oldest segments until the store is within its age and size limits."""
+        if self.__n_exports > 0:
+            return
+        if self.__max_bytes is not None:
+            while len(self.__segments) > 1 and len(self.__segments) * self.__segment_size > self.__max_bytes:
+                self.__remove_segment(self.__segments[next(iter(self.__segments))])
+
+        if self.__max_age is not None:
+            oldest_allowed = time.time() - self.__max_age
+            while (seg := self.__segments[next(iter(self.__segments))]).n_live > 0 and seg.newest < oldest_allowed:
+                self.__remove_segment(seg)
+
+    def append(self, dev_id: bytes, pkt_id: int, ack_id: int, dongle_ts: int, ts: float, data: bytes) -> int:
+        """Stores a packet and returns its sequence number."""
+        seq = self.__next_seq
+        self.__next_seq += 1
+
+        seg, offset, size = self.__append(RecordType.PACKET, seq, dev_id, pkt_id, ack_id, dongle_ts, ts, data)
+        seg.n_live += 1
+        seg.newest = max(seg.newest, ts)
+        self.__devices.setdefault(dev_id, DeviceIndex()).append(seq, ts, encode_loc(seg.seg_no, offset), size)
+        return seq
+
+    def devices(self):
+        return list(self.__devices.keys())
+
+    def count(self, dev_id: bytes) -> int:
+        return len(self.__devices[dev_id])
+
+    def count_bytes(self, dev_id: bytes) -> int:
+        """Size of the records of the packets of the device in the segments."""
+        return self.__devices[dev_id].n_bytes
+
+    @property
+    def n_segments(self) -> int:
+        return len(self.__segments)
+
+    def __index(self, dev_id: bytes, index: int):
+        dev_idx = self.__devices[dev_id]
+        if index < 0:
+            index += len(dev_idx)
+        if index < 0 or index >= len(dev_idx):
+            raise IndexError("packet index out of range")
+        return dev_idx, index
+
+    def __read(self, loc: int):
+        seg_no, offset = decode_loc(loc)
+        (_, _, seq, dev_id, pkt_id, ack_id, dongle_ts, ts), data = self.__segments[seg_no].read(offset)
+        return seq, dev_id, pkt_id, ack_id, dongle_ts, ts, data
+
+    def get(self, dev_id: bytes, index: int):
+        """Returns sequence number, device ID, packet ID, ack ID, dongle timestamp, host timestamp and payload."""
+        dev_idx, index = self.__index(dev_id, index)
+        return self.__read(dev_idx.locs[dev_idx.position(index)])
+
+    @property
+    def last_seq(self) -> int:
+        """Sequence number of the most recently stored packet or -1 if no packet was stored yet."""
+        return self.__next_seq - 1
+
+    def iter(self, dev_id: bytes, since: int = -1):
+        """Iterates over the packets of the device with a sequence number larger than since."""
+        dev_idx = self.__devices[dev_id]
+        while True:
+            # Look up the position again in every step, because the caller may modify the store between iterations
+            idx = dev_idx.next_live(bisect.bisect_right(dev_idx.seqs, since, dev_idx.head))
+            if idx >= len(dev_idx.seqs):
+                return
+            since = dev_idx.seqs[idx]
+            yield self.__read(dev_idx.locs[idx])
+
+    def iter_all(self, dev_ids=None, since: int = -1):
+        """Iterates over the packets of the devices or all devices in the order they were stored."""
+        if dev_ids is None:
+            dev_ids = self.devices()
+        iters = [self.iter(dev_id, since) for dev_id in dev_ids if dev_id in self.__devices]
+        return heapq.merge(*iters, key=lambda record: record[0])
+
+    def iter_range(self, dev_id: bytes, since: float = -math.inf, until: float = math.inf, after=None):
+        """Iterates over the packets of the device with since <= timestamp <= until in the order of their timestamps.
+
+        Yields the position of every packet in the order, i.e., its indexed timestamp and sequence number, together with
+        the record. Iteration starts behind the position after if given.
+        """
+        dev_idx = self.__devices[dev_id]
+        pos = (since, -1) if after is None else max((since, -1), tuple(after))
+        while True:
+            # Look up the position again in every step, because the caller may modify the store between iterations
+            idx = dev_idx.next_live(dev_idx.after(*pos))
+            if idx >= len(dev_idx.seqs) or dev_idx.timestamps[idx] > until:
+                return
+            pos = (dev_idx.timestamps[idx], dev_idx.seqs[idx])
+            yield pos, self.__read(dev_idx.locs[idx])
+
+    def iter_range_all(self, dev_ids=None, since: float = -math.inf, until: float = math.inf, after=None):
+        """Iterates over the packets of the devices or all devices in the time range ordered by their timestamps."""
+        if dev_ids is None:
+            dev_ids = self.devices()
+        iters = [self.iter_range(dev_id, since, until, after) for dev_id in dev_ids if dev_id in self.__devices]
+        return heapq.merge(*iters, key=lambda item: item[0])
+
+    def export(self, dev_ids=None, since: float = -math.inf, until: float = math.inf) -> dict:
+        """Returns the packets of the devices or all devices in the time range as columns ordered by their timestamps.
+
+        The columns are numpy arrays that are copied from the segments without decoding the records one by one. The
+        payloads are concatenated in data, the payload of packet i spans from data_offsets[i] to data_offsets[i + 1].
+        """
+        return self.prepare_export(dev_ids, since, until)()
+
+    def prepare_export(self, dev_ids=None, since: float = -math.inf, until: float = math.inf):
+        """Takes a snapshot of the index for export() and returns the function that copies the columns.
+
+        The function must be called exactly once and may run in another thread while the store is modified. Segments
+        are not removed until it returns.
+        """
+        if dev_ids is None:
+            dev_ids = self.devices()
+        locs, timestamps, seqs, sizes = list(), list(), list(), list()
+        for dev_id in dev_ids:
+            if (dev_idx := self.__devices.get(dev_id)) is None:
+                continue
+            start = bisect.bisect_left(dev_idx.timestamps, since, dev_idx.head)
+            end = bisect.bisect_right(dev_idx.timestamps, until, start)
+            if start == end:
+                continue
+            # Slicing copies, so that the index is not locked by buffers exported to numpy
+            columns = (
+                np.frombuffer(dev_idx.locs[start:end], np.uint64),
+                np.frombuffer(dev_idx.timestamps[start:end], np.float64),
+                np.frombuffer(dev_idx.seqs[start:end], np.uint64),
+                np.frombuffer(dev_idx.sizes[start:end], np.uint16),
+            )
+            if dev_idx.tombstones:
+                live = columns[0] != DELETED_LOC
+                columns = [column[live] for column in columns]
+            for column, col_list in zip(columns, (locs, timestamps, seqs, sizes)):
+                col_list.append(column)
+
+        segments = dict(self.__segments)
+        with self.__exports_lock:
+            self.__n_exports += 1
+
+        def copy():
+            try:
+                return self.__export(segments, locs, timestamps, seqs, sizes)
+            finally:
+                with self.__exports_lock:
+                    self.__n_exports -= 1
+
+        return copy
+
+    @staticmethod
+    def __export(segments: dict, locs: list, timestamps: list, seqs: list, sizes: list) -> dict:
+        if locs:
+            order = np.lexsort((np.concatenate(seqs), np.concatenate(timestamps)))
+            locs = np.concatenate(locs)[order]
+            sizes = np.concatenate(sizes)[order].astype(np.int64)
+        else:
+            locs = np.empty(0, np.uint64)
+            sizes = np.empty(0, np.int64)
+        seg_nos = locs >> np.uint64(32)
+        offsets = (locs & np.uint64(0xFFFFFFFF)).astype(np.int64)
+        lengths = sizes - RECORD_HEADER.size - RECORD_CRC.size
+        data_offsets = np.zeros(len(locs) + 1, np.int64)
+        np.cumsum(lengths, out=data_offsets[1:])
+
+        headers = np.empty(len(locs), RECORD_HEADER_DTYPE)
+        header_bytes = headers.view(np.uint8)
+        data = np.empty(data_offsets[-1], np.uint8)
+        # Rows grouped by segment in the order of the records in the segments
+        by_loc = np.argsort(locs, kind="stable")
+        seg_list, seg_starts = np.unique(seg_nos[by_loc], return_index=True)
+        for seg_no, rows in zip(seg_list, np.split(by_loc, seg_starts[1:])):
+            # Released before returning, an mmap cannot be closed while numpy holds a buffer of it
+            buf = np.frombuffer(segments[int(seg_no)].mm, np.uint8)
+            header_lengths = np.full(len(rows), RECORD_HEADER.size)
+            copy_ranges(header_bytes, rows * RECORD_HEADER.size, buf, offsets[rows], header_lengths, RECORD_HEADER.size)
+            data_starts = offsets[rows] + RECORD_HEADER.size
+            copy_ranges(data, data_offsets[rows], buf, data_starts, lengths[rows], RECORD_DATA_MAX_SIZE)
+            del buf
+
+        return {
+            "dev_id": headers["dev_id"],
+            "pkt_id": headers["pkt_id"],
+            "ack_id": headers["ack_id"],
+            "dongle_timestamp_us": headers["dongle_timestamp_us"].astype(np.uint64),
+            "timestamp": headers["timestamp"],
+            "data_offsets": data_offsets,
+            "data": data,
+        }
+
+    def delete(self, dev_id: bytes, index: int):
+        dev_idx, index = self.__index(dev_id, index)
+        self.__append(RecordType.DELETE, dev_idx.seqs[dev_idx.position(index)], dev_id)
+        if index == 0:
+            self.__drop_head(dev_idx, 1)
+        else:
+            self.__drop(dev_idx, index)
+        self.__reclaim()
+
+    def truncate(self, dev_id: bytes, n: int = None):
+        """Deletes the oldest n packets of the device or all of them."""
+        dev_idx = self.__devices[dev_id]
+        n = len(dev_idx) if n is None else min(n, len(dev_idx))
+        if n == 0:
+            return
+        self.__append(RecordType.TRUNCATE, dev_idx.seqs[dev_idx.position(n - 1)], dev_id)
+        self.__drop_head(dev_idx, n)
+        self.__reclaim()
+
+    def ack(self, dev_id: bytes, seq: int):
+        """Deletes all packets of the device with a sequence number up to and including seq."""
+        self.truncate(dev_id, self.__devices[dev_id].count_until(seq))
+
+    def close(self):
+        for seg in self.__segments.values():
+            seg.close()
+        self.__segments.clear()
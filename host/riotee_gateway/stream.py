@@ -0,0 +1,54 @@
+"""Pushes received packets to subscribers as they arrive."""
+import asyncio
+import logging
+
+# Maximum number of packets buffered per subscriber before it is disconnected
+SUBSCRIBER_QUEUE_SIZE = 1024
+
+
+class Subscriber(object):
+    """A client that receives packets from a set of devices or all devices."""
+
+    def __init__(self, dev_ids: set = None, maxsize: int = SUBSCRIBER_QUEUE_SIZE):
+        self.dev_ids = dev_ids
+        self.queue = asyncio.Queue(maxsize)
+        # Set when the subscriber did not keep up and packets had to be dropped
+        self.overflowed = False
+
+    def wants(self, dev_id: bytes) -> bool:
+        return self.dev_ids is None or dev_id in self.dev_ids
+
+
+class PacketBroadcaster(object):
+    """Distributes packets to all subscribers with a matching device filter.
+
+    Each subscriber has a bounded queue. A subscriber whose queue is full is removed and marked as overflowed instead of
+    blocking the receive loop or buffering without limit. It can resume from the sequence number of the last packet it
+    got, because all packets are still in the store.
+    """
+
+    def __init__(self):
+        self.__subscribers = set()
+
+    def __len__(self):
+        return len(self.__subscribers)
+
+    def subscribe(self, dev_ids: set = None) -> Subscriber:
+        sub = Subscriber(dev_ids)
+        self.__subscribers.add(sub)
+        return sub
+
+    def unsubscribe(self, sub: Subscriber):
+        self.__subscribers.discard(sub)
+
+    def publish(self, seq: int, dev_id: bytes, pkt_json: str):
+        """Queues an already serialized packet for all interested subscribers."""
+        for sub in list(self.__subscribers):
+            if not sub.wants(dev_id):
+                continue
+            try:
+                sub.queue.put_nowait((seq, pkt_json))
+            except asyncio.QueueFull:
+                logging.warning(f"Subscriber fell behind by {sub.queue.qsize()} packets. Disconnecting.")
+                sub.overflowed = True
+                self.unsubscribe(sub)
@@ -1,12 +1,59 @@
+import asyncio
+import base64
+import errno
+import os
 import serial_asyncio
+import struct
+import time
+from collections import deque
 from serial.tools import list_ports
-from datetime import datetime
+from typing import List
 import logging
 
-from riotee_gateway.packet_model import PacketApiReceive
+from riotee_gateway.clock import ClockSync
+from riotee_gateway.delivery import DeliveryTracker
+from riotee_gateway.framing import CREDIT
+from riotee_gateway.framing import Command
+from riotee_gateway.framing import DELIVERED
+from riotee_gateway.framing import DISCARDED
+from riotee_gateway.framing import DiscardReason
+from riotee_gateway.framing import FrameError
+from riotee_gateway.framing import FrameParser
+from riotee_gateway.framing import FrameType
+from riotee_gateway.framing import Framing
+from riotee_gateway.framing import REJECTED
+from riotee_gateway.framing import STATS
+from riotee_gateway.framing import Rate
+from riotee_gateway.framing import STATS_COUNTERS
+from riotee_gateway.framing import TIME
+from riotee_gateway.framing import decode_radio_event
+from riotee_gateway.framing import encode_command
+from riotee_gateway.framing import encode_radio_config
+from riotee_gateway.metrics import FAST_BUCKETS
+from riotee_gateway.metrics import REGISTRY
+from riotee_gateway.packet_model import PacketRecord
 from riotee_gateway.packet_model import PacketTransceiverSend
 
 
+# Upper bound for the data read from the transceiver at once
+READ_SIZE = 16384
+# Frames waiting to be written to the transceiver. Further packets are refused.
+TX_QUEUE_SIZE = 256
+# Upper bound for the data handed to the serial port at once
+TX_BATCH_SIZE = 4096
+
+PARSE_SECONDS = REGISTRY.histogram(
+    "riotee_transceiver_parse_seconds",
+    "Time spent parsing and decoding the data of one read from the transceiver",
+    ["port"],
+    FAST_BUCKETS,
+)
+
+
+class TransceiverBusy(Exception):
+    """The transceiver cannot take more packets at the moment."""
+
+
 class Transceiver(object):
     """Represents the nRF board that communicates with the devices wirelessly."""
 
@@ -14,8 +61,8 @@ class Transceiver(object):
     USB_VID = 0x1209
 
     @staticmethod
-    def find_serial_port() -> str:
-        """Finds the serial port name of an attached gateway dongle based on USB IDs."""
+    def find_serial_ports() -> List[str]:
+        """Finds the serial port names of all attached gateway dongles based on USB IDs."""
         hits = list()
         for port in list_ports.comports():
             if port.vid == Transceiver.USB_VID and port.pid == Transceiver.USB_PID:
@@ -23,15 +70,50 @@ class Transceiver(object):
 
         if not hits:
             raise Exception("Couldn't find serial port of Riotee Gateway.")
-        elif len(hits) == 1:
-            logging.info(f"Found serial port at {hits[0]}")
-            return hits[0]
-        else:
+        logging.info(f"Found serial ports at {' and '.join(hits)}")
+        return hits
+
+    @staticmethod
+    def find_serial_port() -> str:
+        """Finds the serial port name of the attached gateway dongle based on USB IDs."""
+        hits = Transceiver.find_serial_ports()
+        if len(hits) > 1:
             raise Exception(f"Found multiple potential devices at {' and '.join(hits)}")
+        return hits[0]
 
-    def __init__(self, port: str = None, baudrate: int = 1000000):
+    def __init__(self, port: str = None, baudrate: int = 1000000, framing: Framing = Framing.BINARY):
         self.__port = port
         self.__baudrate = baudrate
+        self.__framing_requested = framing
+        # Transceiver always starts with text framing. The parser follows the confirmed changes of framing.
+        self.__parser = FrameParser(Framing.TEXT)
+        # Packets parsed but not yet returned by read_packets()
+        self.__rx_pkts = list()
+        # Latest pipeline counters reported by the transceiver
+        self.__dongle_stats = None
+        # Radio configuration last reported by the transceiver
+        self.__radio = None
+        self.__clock = ClockSync()
+        # Token and host send time of the outstanding time synchronization request
+        self.__sync_request = None
+        self.__sync_token = 0
+        self.__host_stats = {"packets": 0, "decode_errors": 0, "tx_bytes": 0, "tx_rejected": 0, "reconnects": 0}
+        # Frames waiting for the writer task, whether the transceiver restarts counting credits after the frame and a
+        # function called with the host time when the frame is written
+        self.__tx_frames = deque()
+        self.__tx_ready = asyncio.Event()
+        self.__writer_task = None
+        self.__reader = None
+        self.__writer = None
+        # Bytes written since the last SET_FRAMING command
+        self.__tx_bytes = 0
+        # Bytes consumed and receive window last reported by the transceiver. None for firmware without flow control.
+        self.__credit = None
+        self.__credit_ready = asyncio.Event()
+        # Labelled with the port once it is known
+        self.__parse_seconds = None
+        # Receives the delivery reports of downlink packets
+        self.delivery: DeliveryTracker = None
 
     async def __aenter__(self):
         if self.__port is None:
@@ -40,17 +122,242 @@ class Transceiver(object):
         self.__reader, self.__writer = await serial_asyncio.open_serial_connection(
             url=self.__port, baudrate=self.__baudrate
         )
+        self.__parse_seconds = PARSE_SECONDS.labels(self.__port)
+        self.__writer_task = asyncio.create_task(self.__writer_loop())
+        await self.set_framing(self.__framing_requested)
         return self
 
+    @property
+    def port(self) -> str:
+        return self.__port
+
+    @property
+    def connected(self) -> bool:
+        return self.__writer is not None
+
     async def __aexit__(self, *args):
-        pass
+        await self.close()
+
+    async def close(self):
+        """Stops the writer task and closes the serial port, which may already be gone."""
+        if self.__writer_task is not None:
+            self.__writer_task.cancel()
+            try:
+                await self.__writer_task
+            except (asyncio.CancelledError, OSError):
+                pass
+            self.__writer_task = None
+        if self.__writer is not None:
+            self.__writer.close()
+            try:
+                await self.__writer.wait_closed()
+            except OSError:
+                pass
+            self.__reader = None
+            self.__writer = None
+
+    async def reopen(self):
+        """Opens the serial port again after the transceiver was disconnected.
+
+        The transceiver may have been reset in the meantime, so the receive state, the credits and the clock
+        synchronization start over. Frames still waiting for the writer task are sent once the port is open.
+        """
+        await self.close()
+        parser_stats = self.__parser.stats
+        self.__parser = FrameParser(Framing.TEXT)
+        self.__parser.stats = parser_stats
+        self.__rx_pkts = list()
+        self.__tx_bytes = 0
+        self.__credit = None
+        self.__clock = ClockSync()
+        self.__sync_request = None
+        await self.__aenter__()
+        self.__host_stats["reconnects"] += 1
+
+    def __write(self, frame: bytes, restart_credit: bool = False, on_write=None):
+        self.__tx_frames.append((frame, restart_credit, on_write))
+        self.__tx_ready.set()
+
+    def __has_credit(self, n: int) -> bool:
+        if self.__credit is None:
+            return True
+        consumed, window = self.__credit
+        return ((self.__tx_bytes - consumed) & 0xFFFFFFFF) + n <= window
+
+    async def __writer_loop(self):
+        """Writes queued frames in batches as far as the receive window of the transceiver allows."""
+        while True:
+            while not self.__tx_frames:
+                self.__tx_ready.clear()
+                await self.__tx_ready.wait()
+
+            batch = bytearray()
+            restart_credit = False
+            callbacks = list()
+            # The frame that restarts the credits ends the batch
+            while self.__tx_frames and len(batch) < TX_BATCH_SIZE and not restart_credit:
+                frame, restart, on_write = self.__tx_frames[0]
+                if not self.__has_credit(len(batch) + len(frame)):
+                    break
+                self.__tx_frames.popleft()
+                batch += frame
+                restart_credit = restart
+                if on_write is not None:
+                    callbacks.append(on_write)
+
+            if not batch:
+                # Wait until the transceiver has consumed enough data
+                self.__credit_ready.clear()
+                await self.__credit_ready.wait()
+                continue
+
+            t_write = time.time()
+            for on_write in callbacks:
+                on_write(t_write)
+            self.__writer.write(batch)
+            self.__host_stats["tx_bytes"] += len(batch)
+            if restart_credit:
+                self.__tx_bytes = 0
+                if self.__credit is not None:
+                    self.__credit = (0, self.__credit[1])
+            else:
+                self.__tx_bytes += len(batch)
+            await self.__writer.drain()
+
+    async def __wait_framing(self, framing: Framing):
+        """Processes data from the transceiver until it confirms the framing."""
+        while True:
+            await self.__receive()
+            if self.__parser.framing == framing:
+                return
+
+    async def set_framing(self, framing: Framing, timeout: float = 1.0):
+        """Asks the transceiver to switch the framing and waits for the confirmation."""
+        self.__write(encode_command(Command.SET_FRAMING, bytes([framing])), restart_credit=True)
+        try:
+            await asyncio.wait_for(self.__wait_framing(framing), timeout)
+        except asyncio.TimeoutError:
+            # Older firmware ignores the command and keeps sending text frames
+            logging.warning(f"Transceiver did not confirm {framing.name} framing. Using TEXT framing.")
+            return
+        logging.info(f"Using {framing.name} framing")
+
+    def set_radio(self, rate: Rate, channels, dwell_ms: int = 0):
+        """Asks the transceiver to listen on the channels at the data rate, switching channel every dwell_ms."""
+        self.__write(encode_command(Command.SET_RADIO, encode_radio_config(rate, channels, dwell_ms)))
+
+    def request_time(self):
+        """Asks the transceiver for its current time to synchronize the packet timestamps with the host clock."""
+        self.__sync_token = token = (self.__sync_token + 1) & 0xFFFFFFFF
+        self.__sync_request = None
+
+        def sent(t_send: float):
+            # Time spent in the queue must not count as round trip
+            self.__sync_request = (token, t_send)
+
+        self.__write(encode_command(Command.TIME_SYNC, struct.pack("<I", token)), on_write=sent)
+
+    async def clock_sync_loop(self, interval: float = 10.0):
+        while True:
+            self.request_time()
+            await asyncio.sleep(interval)
+
+    def timestamp(self, dongle_timestamp_us: int) -> float:
+        """Host time of a transceiver timestamp or the current time if the clocks are not synchronized yet."""
+        wall = self.__clock.to_wall(dongle_timestamp_us)
+        return time.time() if wall is None else wall
+
+    @property
+    def stats(self) -> dict:
+        """Pipeline counters of the transceiver and the host side of the link."""
+        return {
+            "transceiver": self.__dongle_stats,
+            "host": {**self.__host_stats, **self.__parser.stats, "tx_queue": len(self.__tx_frames)},
+            "radio": self.__radio,
+            "clock": self.__clock.stats,
+        }
+
+    def __handle_event(self, evt_type: int, body: bytes):
+        if evt_type == FrameType.STATS:
+            uptime_ms, *counters = STATS.unpack(body)
+            self.__dongle_stats = {"uptime_ms": uptime_ms, **dict(zip(STATS_COUNTERS, counters))}
+        elif evt_type == FrameType.TIME:
+            t_recv = time.time()
+            token, dongle_us = TIME.unpack(body)
+            if self.__sync_request is not None and self.__sync_request[0] == token:
+                self.__clock.add(self.__sync_request[1], t_recv, dongle_us)
+                self.__sync_request = None
+        elif evt_type == FrameType.RADIO:
+            err, self.__radio = decode_radio_event(body)
+            if err < 0:
+                logging.error(f"Transceiver rejected radio configuration: {os.strerror(-err)}")
+            logging.info(f"Radio configuration: {self.__radio}")
+        elif evt_type == FrameType.REJECTED:
+            dev_id, pkt_id, err = REJECTED.unpack(body)
+            if self.delivery is not None:
+                self.delivery.rejected(dev_id, pkt_id, err)
+            reason = "queue full" if -err in (errno.ENOSPC, errno.ENOMEM) else os.strerror(-err)
+            logging.warning(
+                f"Transceiver rejected packet {pkt_id} for {str(base64.urlsafe_b64encode(dev_id), 'utf-8')}: {reason}"
+            )
+        elif evt_type == FrameType.DELIVERED:
+            dev_id, pkt_id = DELIVERED.unpack(body)
+            if self.delivery is not None:
+                self.delivery.delivered(dev_id, pkt_id)
+        elif evt_type == FrameType.CREDIT:
+            self.__credit = CREDIT.unpack(body)
+            self.__credit_ready.set()
+        elif evt_type == FrameType.DISCARDED:
+            dev_id, pkt_id, reason = DISCARDED.unpack(body)
+            if self.delivery is not None:
+                self.delivery.discarded(dev_id, pkt_id, DiscardReason(reason))
+
+    async def __receive(self):
+        """Reads the available data from the transceiver and processes all complete frames."""
+        data = await self.__reader.read(READ_SIZE)
+        if not data:
+            raise ConnectionError(f"Transceiver at {self.__port} disconnected")
+        t_start = time.perf_counter()
+        self.__parser.feed(data)
+
+        for framing, frame_type, frame in self.__parser.parse():
+            try:
+                if frame_type != FrameType.PACKET:
+                    self.__handle_event(frame_type, frame)
+                    continue
+                if framing == Framing.BINARY:
+                    pkt = PacketRecord.from_frame(frame, 0.0)
+                else:
+                    pkt = PacketRecord.from_uart(frame, 0.0)
+            except (ValueError, struct.error, FrameError) as e:
+                self.__host_stats["decode_errors"] += 1
+                logging.warning(f"Dropping malformed frame of type {frame_type}: {e}")
+                continue
+            pkt.timestamp = self.timestamp(pkt.dongle_timestamp_us)
+            self.__rx_pkts.append(pkt)
+            self.__host_stats["packets"] += 1
+        self.__parse_seconds.observe(time.perf_counter() - t_start)
+
+    async def read_packets(self) -> List[PacketRecord]:
+        """Waits for packets from the transceiver and returns all packets that were received in the meantime."""
+        while not self.__rx_pkts:
+            await self.__receive()
+        pkts, self.__rx_pkts = self.__rx_pkts, list()
+        return pkts
+
+    async def read_packet(self) -> PacketRecord:
+        while not self.__rx_pkts:
+            await self.__receive()
+        return self.__rx_pkts.pop(0)
 
-    async def read_packet(self):
-        await self.__reader.readuntil(b"[")
-        pkt_str = await self.__reader.readuntil(b"]")
-        pkt_str = pkt_str[:-1]
-        return PacketApiReceive.from_uart(pkt_str, datetime.now())
+    @property
+    def tx_full(self) -> bool:
+        return len(self.__tx_frames) >= TX_QUEUE_SIZE
 
     def send_packet(self, pkt: PacketTransceiverSend):
-        self.__writer.write(pkt.to_uart())
+        """Queues the packet for the writer task. Raises TransceiverBusy if the queue is full."""
+        if self.tx_full:
+            self.__host_stats["tx_rejected"] += 1
+            raise TransceiverBusy()
+        self.__write(pkt.to_uart())
         logging.debug(pkt.to_uart())